@@ -0,0 +1,155 @@
+/*
+ * SVAR - detector.c
+ * SPDX-FileCopyrightText: 2025 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "detector.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Percentile of the block RMS used as the noise floor estimate. */
+#define DETECTOR_FLOOR_QUANTILE 0.1f
+/* Noise floor tracking speed (in dB per second). */
+#define DETECTOR_FLOOR_SPEED 2.0f
+
+/* Convert threshold given in % of max signal to the sample units. Thresholds
+ * are compared with ">=", so the result is equivalent to the integer
+ * comparison of the signal in % of max signal. */
+static float detector_threshold(int percent) {
+	return (float)(percent + 1) * 0x7fff / 100;
+}
+
+/* Initialize signal activity detector.
+ *
+ * The open argument is an array of per-channel thresholds. The close
+ * threshold is used by the envelope follower only, and it is limited to
+ * the open threshold of a given channel. Negative close threshold means
+ * that there is no hysteresis. */
+int detector_init(struct detector *d, enum detector_mode mode,
+		unsigned int channels, unsigned int rate, int attack_ms, int release_ms,
+		const int *open, int close) {
+
+	unsigned int c;
+
+	memset(d, 0, sizeof(*d));
+	d->mode = mode;
+	d->channels = channels;
+	d->attack = (float)attack_ms * rate / 1000;
+	d->release = (float)release_ms * rate / 1000;
+	d->margin = -1;
+	d->floor_step = DETECTOR_FLOOR_SPEED / rate;
+
+	if ((d->open = malloc(sizeof(*d->open) * channels)) == NULL ||
+			(d->close = malloc(sizeof(*d->close) * channels)) == NULL ||
+			(d->envelope = calloc(channels, sizeof(*d->envelope))) == NULL ||
+			(d->floor = malloc(sizeof(*d->floor) * channels)) == NULL ||
+			(d->active = calloc(channels, sizeof(*d->active))) == NULL) {
+		detector_free(d);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	for (c = 0; c < channels; c++) {
+		d->open[c] = detector_threshold(open[c]);
+		d->close[c] = detector_threshold(close < 0 || close > open[c] ? open[c] : close);
+		/* noise floor is not known yet */
+		d->floor[c] = NAN;
+	}
+
+	return 0;
+}
+
+void detector_free(struct detector *d) {
+	free(d->open);
+	free(d->close);
+	free(d->envelope);
+	free(d->floor);
+	free(d->active);
+}
+
+/* Enable adaptive thresholds.
+ *
+ * In this mode, the open threshold is the given margin above the estimated
+ * noise floor, while the close threshold is half of the margin above the
+ * noise floor. The noise floor (in dBFS) is a low percentile of the block
+ * RMS, estimated in a streaming fashion. The initial floor might be set by
+ * the caller (e.g. restored from the previous run), otherwise it is taken
+ * from the first block. */
+void detector_set_adaptive(struct detector *d, int margin_db) {
+	d->margin = margin_db;
+}
+
+/* Update noise floor estimation and thresholds of a given channel. */
+static void detector_update_floor(struct detector *d, unsigned int c,
+		int16_t rms, size_t frames) {
+
+	const float x = 20 * log10f((rms > 0 ? rms : 1) / (float)0x7fff);
+	const float step = d->floor_step * frames;
+	float floor = d->floor[c];
+
+	/* Stochastic gradient descent on the pinball loss - the estimation
+	 * converges to the value which is greater than the given fraction of
+	 * observations. It requires constant memory and a single comparison
+	 * per block. */
+	if (isnan(floor))
+		floor = x;
+	else if (x < floor)
+		floor -= step * (1 - DETECTOR_FLOOR_QUANTILE);
+	else
+		floor += step * DETECTOR_FLOOR_QUANTILE;
+
+	d->floor[c] = floor;
+	d->open[c] = 0x7fff * powf(10, (floor + d->margin) / 20);
+	d->close[c] = 0x7fff * powf(10, (floor + d->margin / 2) / 20);
+
+}
+
+/* Get the smoothing coefficient of a one-pole filter for a given number of
+ * frames and the time constant. */
+static float detector_coefficient(size_t frames, float tau) {
+	if (tau < 1)
+		return 1;
+	return 1 - expf(-(float)frames / tau);
+}
+
+/* Update channel activity with the peak and RMS values of the next frames. */
+void detector_update(struct detector *d, const int16_t *peak,
+		const int16_t *rms, size_t frames) {
+
+	unsigned int c;
+
+	if (d->margin >= 0)
+		for (c = 0; c < d->channels; c++)
+			detector_update_floor(d, c, rms[c], frames);
+
+	if (d->mode == DETECTOR_PEAK) {
+		for (c = 0; c < d->channels; c++)
+			d->active[c] = peak[c] >= d->open[c];
+		return;
+	}
+
+	/* The envelope is updated once per block of frames, so the coefficients
+	 * are scaled to the block length. This way the time constants do not
+	 * depend on the detection window size. */
+	const float attack = detector_coefficient(frames, d->attack);
+	const float release = detector_coefficient(frames, d->release);
+
+	for (c = 0; c < d->channels; c++) {
+
+		const float x = peak[c];
+		float env = d->envelope[c];
+
+		env += (x > env ? attack : release) * (x - env);
+		d->envelope[c] = env;
+
+		/* hysteresis: once active, the channel stays active until the
+		 * envelope drops below the close threshold */
+		d->active[c] = env >= (d->active[c] ? d->close[c] : d->open[c]);
+
+	}
+
+}
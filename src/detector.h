@@ -0,0 +1,51 @@
+/*
+ * SVAR - detector.h
+ * SPDX-FileCopyrightText: 2025 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef SVAR_DETECTOR_H_
+#define SVAR_DETECTOR_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum detector_mode {
+	/* peak above the threshold */
+	DETECTOR_PEAK = 0,
+	/* envelope follower with hysteresis */
+	DETECTOR_ENVELOPE,
+};
+
+/* Per-channel signal activity detector. */
+struct detector {
+	enum detector_mode mode;
+	unsigned int channels;
+	/* attack and release time constants (in frames) */
+	float attack;
+	float release;
+	/* open and close thresholds (in sample units) */
+	float *open;
+	float *close;
+	/* adaptive threshold margin above the noise floor (in dB),
+	 * negative value means that thresholds are fixed */
+	float margin;
+	/* noise floor tracking speed (in dB per frame) */
+	float floor_step;
+	/* per-channel state */
+	float *envelope;
+	float *floor;
+	bool *active;
+};
+
+int detector_init(struct detector *d, enum detector_mode mode,
+		unsigned int channels, unsigned int rate, int attack_ms, int release_ms,
+		const int *open, int close);
+void detector_set_adaptive(struct detector *d, int margin_db);
+void detector_free(struct detector *d);
+
+void detector_update(struct detector *d, const int16_t *peak,
+		const int16_t *rms, size_t frames);
+
+#endif
@@ -0,0 +1,276 @@
+/*
+ * SVAR - elastic.c
+ * SPDX-FileCopyrightText: 2025 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "elastic.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "debug.h"
+
+/* Get the size of a memory block aligned for the next block header. */
+static size_t elastic_block_size(const struct elastic *e) {
+	const size_t align = _Alignof(struct elastic_block);
+	const size_t size = sizeof(struct elastic_block) + e->block_frames * e->frame_size;
+	return (size + align - 1) / align * align;
+}
+
+int elastic_init(struct elastic *e, size_t frame_size, size_t block_frames,
+		size_t blocks_max, off_t spill_max, const char *spill_dir) {
+
+	memset(e, 0, sizeof(*e));
+
+	pthread_mutex_init(&e->mutex, NULL);
+	atomic_init(&e->pending, false);
+	e->frame_size = frame_size;
+	e->block_frames = block_frames;
+	e->blocks_max = blocks_max;
+	e->spill_fd = -1;
+	e->spill_max = spill_max;
+
+	if (spill_dir != NULL &&
+			(e->spill_dir = strdup(spill_dir)) == NULL)
+		goto fail;
+
+	/* Memory for all blocks is reserved up front, so the producer does not
+	 * have to call the allocator. Pages of the arena are committed by the
+	 * kernel on the first use, so unused blocks do not take any memory. */
+	if (blocks_max > 0) {
+
+		const size_t block_size = elastic_block_size(e);
+		size_t i;
+
+		if ((e->arena = malloc(block_size * blocks_max)) == NULL)
+			goto fail;
+
+		for (i = blocks_max; i > 0; i--) {
+			struct elastic_block *b = (void *)((char *)e->arena + block_size * (i - 1));
+			b->next = e->free;
+			e->free = b;
+		}
+
+	}
+
+	return 0;
+
+fail:
+	elastic_free(e);
+	errno = ENOMEM;
+	return -1;
+}
+
+void elastic_free(struct elastic *e) {
+	free(e->arena);
+	free(e->spill_dir);
+	if (e->spill_fd != -1)
+		close(e->spill_fd);
+	pthread_mutex_destroy(&e->mutex);
+}
+
+/* Create anonymous spill file in the spill directory. */
+static int elastic_spill_open(struct elastic *e) {
+
+	const char *dir = e->spill_dir;
+	char path[512];
+
+	if (dir == NULL && (dir = getenv("TMPDIR")) == NULL)
+		dir = "/tmp";
+
+	snprintf(path, sizeof(path), "%s/svar-spill-XXXXXX", dir);
+	if ((e->spill_fd = mkstemp(path)) == -1) {
+		error("Couldn't create spill file: %s: %s", path, strerror(errno));
+		return -1;
+	}
+
+	/* the file will be removed automatically when closed */
+	unlink(path);
+	return 0;
+}
+
+/* Queue frames (producer side).
+ *
+ * Frames are appended to memory blocks taken from the free list. Frames
+ * which do not fit are dropped. This function returns the number of queued
+ * frames. The lock is held only for the memory copy, so the producer is
+ * never blocked by the file I/O done by the consumer. */
+size_t elastic_write(struct elastic *e, const void *buffer, size_t frames) {
+
+	const unsigned char *data = buffer;
+	size_t total = frames;
+	size_t n;
+
+	pthread_mutex_lock(&e->mutex);
+
+	while (frames > 0) {
+
+		struct elastic_block *b = e->last;
+		if (b == NULL || b->tail == e->block_frames) {
+
+			if ((b = e->free) == NULL)
+				break;
+			e->free = b->next;
+
+			b->next = NULL;
+			b->head = b->tail = 0;
+			if (e->last != NULL)
+				e->last->next = b;
+			else
+				e->first = b;
+			e->last = b;
+			e->blocks++;
+
+		}
+
+		if ((n = e->block_frames - b->tail) > frames)
+			n = frames;
+		memcpy(b->data + b->tail * e->frame_size, data, n * e->frame_size);
+		data += n * e->frame_size;
+		b->tail += n;
+		frames -= n;
+
+	}
+
+	e->dropped += frames * e->frame_size;
+	if (frames < total)
+		atomic_store_explicit(&e->pending, true, memory_order_release);
+
+	pthread_mutex_unlock(&e->mutex);
+	return total - frames;
+}
+
+/* Move memory blocks to the spill file (consumer side).
+ *
+ * When more than half of the memory blocks are in use, the oldest full
+ * blocks are appended to the spill file, so the producer always has some
+ * free blocks to write to. The block being written is detached from the
+ * queue, so the lock is not held during the file I/O. */
+void elastic_spill(struct elastic *e) {
+
+	struct elastic_block *b;
+	ssize_t len;
+
+	while (e->spill_max > 0) {
+
+		pthread_mutex_lock(&e->mutex);
+
+		if (e->blocks <= e->blocks_max / 2 ||
+				(b = e->first)->tail != e->block_frames ||
+				(len = (b->tail - b->head) * e->frame_size) >
+				e->spill_max - (e->spill_wr - e->spill_rd)) {
+			pthread_mutex_unlock(&e->mutex);
+			break;
+		}
+
+		if ((e->first = b->next) == NULL)
+			e->last = NULL;
+		e->blocks--;
+
+		pthread_mutex_unlock(&e->mutex);
+
+		if ((e->spill_fd == -1 && elastic_spill_open(e) == -1) ||
+				pwrite(e->spill_fd, b->data + b->head * e->frame_size, len, e->spill_wr) != len) {
+
+			if (e->spill_fd != -1)
+				error("Couldn't write spill file: %s", strerror(errno));
+			/* put the block back and do not try again */
+			e->spill_max = 0;
+
+			pthread_mutex_lock(&e->mutex);
+			if ((b->next = e->first) == NULL)
+				e->last = b;
+			e->first = b;
+			e->blocks++;
+			pthread_mutex_unlock(&e->mutex);
+			break;
+
+		}
+
+		e->spill_wr += len;
+		e->spilled += len;
+
+		pthread_mutex_lock(&e->mutex);
+		b->next = e->free;
+		e->free = b;
+		pthread_mutex_unlock(&e->mutex);
+
+	}
+
+}
+
+/* Dequeue frames (consumer side).
+ *
+ * Frames are read from the spill file first, because it always contains the
+ * oldest data. This function returns the number of frames copied into the
+ * given buffer. When the spill file has been drained, it is truncated. */
+size_t elastic_read(struct elastic *e, void *buffer, size_t frames) {
+
+	struct elastic_block *b;
+	ssize_t len;
+	size_t n = 0;
+
+	if (e->spill_wr > e->spill_rd) {
+
+		if ((len = e->spill_wr - e->spill_rd) > (ssize_t)(frames * e->frame_size))
+			len = frames * e->frame_size;
+
+		if ((len = pread(e->spill_fd, buffer, len, e->spill_rd)) == -1) {
+			error("Couldn't read spill file: %s", strerror(errno));
+			len = e->spill_wr - e->spill_rd;
+			pthread_mutex_lock(&e->mutex);
+			e->dropped += len;
+			pthread_mutex_unlock(&e->mutex);
+		}
+		else
+			n = len / e->frame_size;
+
+		e->spill_rd += n * e->frame_size;
+		if (len != (ssize_t)(n * e->frame_size))
+			e->spill_rd = e->spill_wr;
+
+		if (e->spill_rd == e->spill_wr) {
+			e->spill_rd = e->spill_wr = 0;
+			if (ftruncate(e->spill_fd, 0) == -1)
+				warn("Couldn't truncate spill file: %s", strerror(errno));
+		}
+
+		pthread_mutex_lock(&e->mutex);
+
+	}
+	else {
+
+		pthread_mutex_lock(&e->mutex);
+
+		if ((b = e->first) != NULL && b->head < b->tail) {
+
+			if ((n = b->tail - b->head) > frames)
+				n = frames;
+			memcpy(buffer, b->data + b->head * e->frame_size, n * e->frame_size);
+			b->head += n;
+
+			/* release drained block, unless the producer still appends to it */
+			if (b->head == b->tail && (b->tail == e->block_frames || b->next != NULL)) {
+				if ((e->first = b->next) == NULL)
+					e->last = NULL;
+				e->blocks--;
+				b->next = e->free;
+				e->free = b;
+			}
+
+		}
+
+	}
+
+	/* check whether the queue has been drained */
+	if ((e->first == NULL || e->first->head == e->first->tail) &&
+			e->spill_wr == e->spill_rd)
+		atomic_store_explicit(&e->pending, false, memory_order_release);
+
+	pthread_mutex_unlock(&e->mutex);
+	return n;
+}
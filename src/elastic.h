@@ -0,0 +1,68 @@
+/*
+ * SVAR - elastic.h
+ * SPDX-FileCopyrightText: 2025 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef SVAR_ELASTIC_H_
+#define SVAR_ELASTIC_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct elastic_block {
+	struct elastic_block *next;
+	/* read and write positions (in frames) */
+	size_t head;
+	size_t tail;
+	unsigned char data[];
+};
+
+/* Elastic FIFO queue of frames with a spill file.
+ *
+ * There is exactly one producer and one consumer. The producer only appends
+ * frames to memory blocks, so it never calls the allocator nor performs any
+ * file I/O. The consumer moves the oldest memory blocks to the spill file,
+ * hence data in the spill file are always older than data in memory. */
+struct elastic {
+	pthread_mutex_t mutex;
+	/* true if there are any queued frames */
+	atomic_bool pending;
+	/* size of a single frame in bytes */
+	size_t frame_size;
+	/* memory blocks */
+	void *arena;
+	struct elastic_block *free;
+	struct elastic_block *first;
+	struct elastic_block *last;
+	size_t block_frames;
+	size_t blocks_max;
+	size_t blocks;
+	/* spill file (consumer side only) */
+	char *spill_dir;
+	int spill_fd;
+	off_t spill_rd;
+	off_t spill_wr;
+	off_t spill_max;
+	/* statistics (in bytes) */
+	uint64_t spilled;
+	uint64_t dropped;
+};
+
+int elastic_init(struct elastic *e, size_t frame_size, size_t block_frames,
+		size_t blocks_max, off_t spill_max, const char *spill_dir);
+void elastic_free(struct elastic *e);
+
+static inline bool elastic_pending(struct elastic *e) {
+	return atomic_load_explicit(&e->pending, memory_order_acquire);
+}
+
+size_t elastic_write(struct elastic *e, const void *buffer, size_t frames);
+size_t elastic_read(struct elastic *e, void *buffer, size_t frames);
+void elastic_spill(struct elastic *e);
+
+#endif
@@ -0,0 +1,413 @@
+/*
+ * SVAR - level.c
+ * SPDX-FileCopyrightText: 2025 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "level.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define LEVEL_X86 1
+#elif defined(__ARM_NEON)
+# include <arm_neon.h>
+# define LEVEL_NEON 1
+#endif
+
+/* Per-channel peak and sum of squares reduction kernel. */
+typedef void (*level_reduce_t)(const int16_t *, size_t, unsigned int,
+		int16_t *, uint64_t *);
+
+/* Deinterleave and scale kernel. */
+typedef void (*level_convert_t)(const int16_t *, size_t, unsigned int,
+		float *const *, float, const float *, int32_t *);
+
+/* Update per-channel max absolute sample value (saturated to INT16_MAX) and
+ * sum of squares with given interleaved frames. This is the reference
+ * implementation, which is also used for the tail of the SIMD kernels. */
+void level_reduce_S16_LE_scalar(const int16_t *buffer, size_t frames,
+		unsigned int channels, int16_t *peak, uint64_t *sum2) {
+
+	size_t i;
+	unsigned int c;
+
+	for (i = 0; i < frames; i++)
+		for (c = 0; c < channels; c++) {
+			const int32_t x = *buffer++;
+			const int16_t abslvl = x == INT16_MIN ? INT16_MAX : (x < 0 ? -x : x);
+			if (peak[c] < abslvl)
+				peak[c] = abslvl;
+			sum2[c] += (uint32_t)(x * x);
+		}
+
+}
+
+/* Deinterleave frames into per-channel planes with the given scale and
+ * per-channel bias, and update per-channel sums of samples. This is the
+ * reference implementation for any number of channels, which is also used
+ * for the tail of the SIMD kernels. */
+static void level_convert_S16_LE_scalar(const int16_t *buffer, size_t frames,
+		unsigned int channels, float *const *planes, float scale, const float *bias,
+		int32_t *sum) {
+
+	size_t i;
+	unsigned int c;
+
+	for (c = 0; c < channels; c++) {
+		const int16_t *src = &buffer[c];
+		float *dst = planes[c];
+		int32_t s = 0;
+		for (i = 0; i < frames; i++) {
+			const int32_t x = src[i * channels];
+			s += x;
+			dst[i] = x * scale + bias[c];
+		}
+		sum[c] += s;
+	}
+
+}
+
+/* Fold per-lane accumulators into channels. Vector lanes are mapped to
+ * channels in a round-robin fashion, which requires the number of lanes
+ * to be a multiple of the number of channels. */
+static void level_fold(const int16_t *lanes_peak, const uint64_t *lanes_sum2,
+		unsigned int lanes, unsigned int channels, int16_t *peak, uint64_t *sum2) {
+	unsigned int i;
+	for (i = 0; i < lanes; i++) {
+		if (peak[i % channels] < lanes_peak[i])
+			peak[i % channels] = lanes_peak[i];
+		sum2[i % channels] += lanes_sum2[i];
+	}
+}
+
+#if LEVEL_X86
+
+__attribute__((target("sse2")))
+static void level_reduce_S16_LE_sse2(const int16_t *buffer, size_t frames,
+		unsigned int channels, int16_t *peak, uint64_t *sum2) {
+
+	if (8 % channels != 0)
+		return level_reduce_S16_LE_scalar(buffer, frames, channels, peak, sum2);
+
+	const size_t samples = frames * channels;
+	const __m128i zero = _mm_setzero_si128();
+	__m128i vpeak = zero;
+	__m128i vsum[4] = { zero, zero, zero, zero };
+	int16_t lanes_peak[8];
+	uint64_t lanes_sum2[8];
+	size_t i;
+
+	for (i = 0; i + 8 <= samples; i += 8) {
+		const __m128i v = _mm_loadu_si128((const __m128i *)&buffer[i]);
+		/* saturating subtraction gives abs(INT16_MIN) == INT16_MAX */
+		vpeak = _mm_max_epi16(vpeak, _mm_max_epi16(v, _mm_subs_epi16(zero, v)));
+		/* 32-bit squares from low and high halves of 16-bit products */
+		const __m128i lo = _mm_mullo_epi16(v, v);
+		const __m128i hi = _mm_mulhi_epi16(v, v);
+		const __m128i sq03 = _mm_unpacklo_epi16(lo, hi);
+		const __m128i sq47 = _mm_unpackhi_epi16(lo, hi);
+		vsum[0] = _mm_add_epi64(vsum[0], _mm_unpacklo_epi32(sq03, zero));
+		vsum[1] = _mm_add_epi64(vsum[1], _mm_unpackhi_epi32(sq03, zero));
+		vsum[2] = _mm_add_epi64(vsum[2], _mm_unpacklo_epi32(sq47, zero));
+		vsum[3] = _mm_add_epi64(vsum[3], _mm_unpackhi_epi32(sq47, zero));
+	}
+
+	_mm_storeu_si128((__m128i *)lanes_peak, vpeak);
+	for (unsigned int j = 0; j < 4; j++)
+		_mm_storeu_si128((__m128i *)&lanes_sum2[j * 2], vsum[j]);
+
+	level_fold(lanes_peak, lanes_sum2, 8, channels, peak, sum2);
+	level_reduce_S16_LE_scalar(&buffer[i], (samples - i) / channels,
+			channels, peak, sum2);
+
+}
+
+__attribute__((target("avx2")))
+static void level_reduce_S16_LE_avx2(const int16_t *buffer, size_t frames,
+		unsigned int channels, int16_t *peak, uint64_t *sum2) {
+
+	if (16 % channels != 0)
+		return level_reduce_S16_LE_sse2(buffer, frames, channels, peak, sum2);
+
+	const size_t samples = frames * channels;
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i vpeak = zero;
+	__m256i vsum[4] = { zero, zero, zero, zero };
+	int16_t lanes_peak[16];
+	uint64_t lanes_sum2[16];
+	uint64_t tmp[4];
+	size_t i;
+
+	for (i = 0; i + 16 <= samples; i += 16) {
+		const __m256i v = _mm256_loadu_si256((const __m256i *)&buffer[i]);
+		vpeak = _mm256_max_epi16(vpeak, _mm256_max_epi16(v, _mm256_subs_epi16(zero, v)));
+		const __m256i lo = _mm256_mullo_epi16(v, v);
+		const __m256i hi = _mm256_mulhi_epi16(v, v);
+		/* AVX2 unpacks operate within 128-bit halves, so accumulators hold
+		 * lanes {0,1,8,9}, {2,3,10,11}, {4,5,12,13} and {6,7,14,15} */
+		const __m256i sq_lo = _mm256_unpacklo_epi16(lo, hi);
+		const __m256i sq_hi = _mm256_unpackhi_epi16(lo, hi);
+		vsum[0] = _mm256_add_epi64(vsum[0], _mm256_unpacklo_epi32(sq_lo, zero));
+		vsum[1] = _mm256_add_epi64(vsum[1], _mm256_unpackhi_epi32(sq_lo, zero));
+		vsum[2] = _mm256_add_epi64(vsum[2], _mm256_unpacklo_epi32(sq_hi, zero));
+		vsum[3] = _mm256_add_epi64(vsum[3], _mm256_unpackhi_epi32(sq_hi, zero));
+	}
+
+	_mm256_storeu_si256((__m256i *)lanes_peak, vpeak);
+	for (unsigned int j = 0; j < 4; j++) {
+		_mm256_storeu_si256((__m256i *)tmp, vsum[j]);
+		lanes_sum2[j * 2 + 0] = tmp[0];
+		lanes_sum2[j * 2 + 1] = tmp[1];
+		lanes_sum2[j * 2 + 8] = tmp[2];
+		lanes_sum2[j * 2 + 9] = tmp[3];
+	}
+
+	level_fold(lanes_peak, lanes_sum2, 16, channels, peak, sum2);
+	level_reduce_S16_LE_scalar(&buffer[i], (samples - i) / channels,
+			channels, peak, sum2);
+
+}
+
+__attribute__((target("sse2")))
+static void level_convert_S16_LE_sse2(const int16_t *buffer, size_t frames,
+		unsigned int channels, float *const *planes, float scale, const float *bias,
+		int32_t *sum) {
+
+	if (channels > 2)
+		return level_convert_S16_LE_scalar(buffer, frames, channels, planes, scale, bias, sum);
+
+	const __m128 vscale = _mm_set1_ps(scale);
+	__m128i vsum = _mm_setzero_si128();
+	int32_t lanes_sum[4];
+	size_t i = 0;
+
+	if (channels == 1) {
+		const __m128 vbias = _mm_set1_ps(bias[0]);
+		float *dst = planes[0];
+		for (; i + 8 <= frames; i += 8) {
+			const __m128i v = _mm_loadu_si128((const __m128i *)&buffer[i]);
+			/* sign extension to 32 bits: duplicate and shift */
+			const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+			const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+			vsum = _mm_add_epi32(vsum, _mm_add_epi32(lo, hi));
+			_mm_storeu_ps(&dst[i], _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(lo), vscale), vbias));
+			_mm_storeu_ps(&dst[i + 4], _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(hi), vscale), vbias));
+		}
+		_mm_storeu_si128((__m128i *)lanes_sum, vsum);
+		sum[0] += lanes_sum[0] + lanes_sum[1] + lanes_sum[2] + lanes_sum[3];
+	}
+	else {
+		const __m128 vbias0 = _mm_set1_ps(bias[0]);
+		const __m128 vbias1 = _mm_set1_ps(bias[1]);
+		float *dst0 = planes[0];
+		float *dst1 = planes[1];
+		for (; i + 4 <= frames; i += 4) {
+			const __m128i v = _mm_loadu_si128((const __m128i *)&buffer[i * 2]);
+			/* frames {0,1} and {2,3} with interleaved channels */
+			const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+			const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+			vsum = _mm_add_epi32(vsum, _mm_add_epi32(lo, hi));
+			const __m128 flo = _mm_cvtepi32_ps(lo);
+			const __m128 fhi = _mm_cvtepi32_ps(hi);
+			const __m128 ch0 = _mm_shuffle_ps(flo, fhi, _MM_SHUFFLE(2, 0, 2, 0));
+			const __m128 ch1 = _mm_shuffle_ps(flo, fhi, _MM_SHUFFLE(3, 1, 3, 1));
+			_mm_storeu_ps(&dst0[i], _mm_add_ps(_mm_mul_ps(ch0, vscale), vbias0));
+			_mm_storeu_ps(&dst1[i], _mm_add_ps(_mm_mul_ps(ch1, vscale), vbias1));
+		}
+		_mm_storeu_si128((__m128i *)lanes_sum, vsum);
+		sum[0] += lanes_sum[0] + lanes_sum[2];
+		sum[1] += lanes_sum[1] + lanes_sum[3];
+	}
+
+	if (i < frames) {
+		float *const tail[2] = { &planes[0][i], channels == 2 ? &planes[1][i] : NULL };
+		level_convert_S16_LE_scalar(&buffer[i * channels], frames - i, channels,
+				tail, scale, bias, sum);
+	}
+
+}
+
+#endif
+
+#if LEVEL_NEON
+
+static void level_reduce_S16_LE_neon(const int16_t *buffer, size_t frames,
+		unsigned int channels, int16_t *peak, uint64_t *sum2) {
+
+	if (8 % channels != 0)
+		return level_reduce_S16_LE_scalar(buffer, frames, channels, peak, sum2);
+
+	const size_t samples = frames * channels;
+	int16x8_t vpeak = vdupq_n_s16(0);
+	uint64x2_t vsum[4] = { vdupq_n_u64(0), vdupq_n_u64(0),
+		vdupq_n_u64(0), vdupq_n_u64(0) };
+	int16_t lanes_peak[8];
+	uint64_t lanes_sum2[8];
+	size_t i;
+
+	for (i = 0; i + 8 <= samples; i += 8) {
+		const int16x8_t v = vld1q_s16(&buffer[i]);
+		/* saturating absolute value gives abs(INT16_MIN) == INT16_MAX */
+		vpeak = vmaxq_s16(vpeak, vqabsq_s16(v));
+		const uint32x4_t sq03 = vreinterpretq_u32_s32(
+				vmull_s16(vget_low_s16(v), vget_low_s16(v)));
+		const uint32x4_t sq47 = vreinterpretq_u32_s32(
+				vmull_s16(vget_high_s16(v), vget_high_s16(v)));
+		vsum[0] = vaddw_u32(vsum[0], vget_low_u32(sq03));
+		vsum[1] = vaddw_u32(vsum[1], vget_high_u32(sq03));
+		vsum[2] = vaddw_u32(vsum[2], vget_low_u32(sq47));
+		vsum[3] = vaddw_u32(vsum[3], vget_high_u32(sq47));
+	}
+
+	vst1q_s16(lanes_peak, vpeak);
+	for (unsigned int j = 0; j < 4; j++)
+		vst1q_u64(&lanes_sum2[j * 2], vsum[j]);
+
+	level_fold(lanes_peak, lanes_sum2, 8, channels, peak, sum2);
+	level_reduce_S16_LE_scalar(&buffer[i], (samples - i) / channels,
+			channels, peak, sum2);
+
+}
+
+static void level_convert_S16_LE_neon(const int16_t *buffer, size_t frames,
+		unsigned int channels, float *const *planes, float scale, const float *bias,
+		int32_t *sum) {
+
+	if (channels > 2)
+		return level_convert_S16_LE_scalar(buffer, frames, channels, planes, scale, bias, sum);
+
+	int32x4_t vsum[2] = { vdupq_n_s32(0), vdupq_n_s32(0) };
+	int16x8_t v[2];
+	size_t i;
+
+	for (i = 0; i + 8 <= frames; i += 8) {
+		if (channels == 1)
+			v[0] = vld1q_s16(&buffer[i]);
+		else {
+			/* structured load deinterleaves channels */
+			const int16x8x2_t vv = vld2q_s16(&buffer[i * 2]);
+			v[0] = vv.val[0];
+			v[1] = vv.val[1];
+		}
+		for (unsigned int c = 0; c < channels; c++) {
+			const float32x4_t vbias = vdupq_n_f32(bias[c]);
+			const int32x4_t lo = vmovl_s16(vget_low_s16(v[c]));
+			const int32x4_t hi = vmovl_s16(vget_high_s16(v[c]));
+			vsum[c] = vpadalq_s16(vsum[c], v[c]);
+			vst1q_f32(&planes[c][i], vmlaq_n_f32(vbias, vcvtq_f32_s32(lo), scale));
+			vst1q_f32(&planes[c][i + 4], vmlaq_n_f32(vbias, vcvtq_f32_s32(hi), scale));
+		}
+	}
+
+	for (unsigned int c = 0; c < channels; c++) {
+		const int32x2_t tmp = vadd_s32(vget_low_s32(vsum[c]), vget_high_s32(vsum[c]));
+		sum[c] += vget_lane_s32(vpadd_s32(tmp, tmp), 0);
+	}
+
+	if (i < frames) {
+		float *const tail[2] = { &planes[0][i], channels == 2 ? &planes[1][i] : NULL };
+		level_convert_S16_LE_scalar(&buffer[i * channels], frames - i, channels,
+				tail, scale, bias, sum);
+	}
+
+}
+
+#endif
+
+static level_reduce_t level_reduce = level_reduce_S16_LE_scalar;
+static const char *level_reduce_name = "scalar";
+static level_convert_t level_convert = level_convert_S16_LE_scalar;
+
+/* Select the best reduction kernel for the current CPU. */
+void level_init(void) {
+#if LEVEL_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		level_reduce = level_reduce_S16_LE_avx2;
+		level_reduce_name = "AVX2";
+	}
+	else if (__builtin_cpu_supports("sse2")) {
+		level_reduce = level_reduce_S16_LE_sse2;
+		level_reduce_name = "SSE2";
+	}
+	/* conversion is limited by the memory bandwidth, so there is no gain
+	 * from the wider AVX2 registers */
+	if (__builtin_cpu_supports("sse2"))
+		level_convert = level_convert_S16_LE_sse2;
+#elif LEVEL_NEON
+	level_reduce = level_reduce_S16_LE_neon;
+	level_reduce_name = "NEON";
+	level_convert = level_convert_S16_LE_neon;
+#endif
+}
+
+/* Get the name of the selected reduction kernel. */
+const char *level_kernel_name(void) {
+	return level_reduce_name;
+}
+
+/* Calculate per-channel max peak and amplitude RMS.
+ *
+ * The peak and rms arrays shall have room for the given number of channels.
+ * All channels are analyzed in a single pass over the interleaved data. */
+void level_S16_LE(const int16_t *buffer, size_t frames, unsigned int channels,
+		int16_t *peak, int16_t *rms) {
+
+	uint64_t sum2[channels];
+	unsigned int c;
+
+	memset(peak, 0, sizeof(*peak) * channels);
+	memset(sum2, 0, sizeof(sum2));
+
+	level_reduce(buffer, frames, channels, peak, sum2);
+
+	for (c = 0; c < channels; c++)
+		rms[c] = frames > 0 ? ceil(sqrt((double)sum2[c] / frames)) : 0;
+
+}
+
+/* Number of frames processed at once by the conversion kernel. */
+#define LEVEL_BLOCK_FRAMES 256
+/* Smoothing factor of the per-block DC offset estimation. */
+#define LEVEL_DC_SMOOTHING (1.0f / 64)
+
+/* Convert interleaved frames into per-channel float planes.
+ *
+ * Data are processed in blocks small enough to stay in the L1 cache while
+ * all channels of a block are deinterleaved, so the interleaved buffer is
+ * read from the memory only once. In the same pass, the DC offset is removed
+ * (if the dc array is not NULL). The DC offset is estimated as a smoothed
+ * mean of blocks, and the estimation from the previous block is subtracted
+ * from the current one. */
+void level_planes_S16_LE(const int16_t *buffer, size_t frames, unsigned int channels,
+		float *const *planes, float *dc) {
+
+	const float scale = 1.0f / 0x7ffe;
+	unsigned int c;
+	size_t i;
+
+	for (i = 0; i < frames; i += LEVEL_BLOCK_FRAMES) {
+
+		const size_t n = frames - i < LEVEL_BLOCK_FRAMES ? frames - i : LEVEL_BLOCK_FRAMES;
+		float *dst[channels];
+		float bias[channels];
+		int32_t sum[channels];
+
+		for (c = 0; c < channels; c++) {
+			dst[c] = &planes[c][i];
+			bias[c] = dc != NULL ? -dc[c] * scale : 0;
+			sum[c] = 0;
+		}
+
+		level_convert(&buffer[i * channels], n, channels, dst, scale, bias, sum);
+
+		if (dc != NULL)
+			for (c = 0; c < channels; c++)
+				dc[c] += ((float)sum[c] / n - dc[c]) * LEVEL_DC_SMOOTHING;
+
+	}
+
+}
@@ -0,0 +1,25 @@
+/*
+ * SVAR - level.h
+ * SPDX-FileCopyrightText: 2025 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef SVAR_LEVEL_H_
+#define SVAR_LEVEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+void level_init(void);
+const char *level_kernel_name(void);
+
+void level_S16_LE(const int16_t *buffer, size_t frames, unsigned int channels,
+		int16_t *peak, int16_t *rms);
+
+void level_reduce_S16_LE_scalar(const int16_t *buffer, size_t frames,
+		unsigned int channels, int16_t *peak, uint64_t *sum2);
+
+void level_planes_S16_LE(const int16_t *buffer, size_t frames, unsigned int channels,
+		float *const *planes, float *dc);
+
+#endif
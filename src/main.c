@@ -10,9 +10,12 @@
 
 #include <errno.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <math.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -21,6 +24,7 @@
 #include <strings.h>
 #include <sys/time.h>
 #include <time.h>
+#include <unistd.h>
 
 #if ENABLE_PORTAUDIO
 # include <portaudio.h>
@@ -37,11 +41,21 @@
 #if ENABLE_VORBIS
 # include "writer_vorbis.h"
 #endif
+#if ENABLE_OPUS
+# include "writer_opus.h"
+#endif
+#if ENABLE_FLAC
+# include "writer_flac.h"
+#endif
 
 #include "debug.h"
-
-#define READER_FRAMES 512 * 8
-#define PROCESSING_FRAMES READER_FRAMES * 16
+#include "detector.h"
+#include "elastic.h"
+#include "level.h"
+#include "output.h"
+#include "ringbuffer.h"
+#include "tone.h"
+#include "vad.h"
 
 enum output_format {
 	FORMAT_RAW = 0,
@@ -54,6 +68,12 @@ enum output_format {
 #if ENABLE_VORBIS
 	FORMAT_OGG,
 #endif
+#if ENABLE_OPUS
+	FORMAT_OPUS,
+#endif
+#if ENABLE_FLAC
+	FORMAT_FLAC,
+#endif
 };
 
 /* available output formats */
@@ -71,6 +91,135 @@ static const struct {
 #if ENABLE_VORBIS
 	{ FORMAT_OGG, "ogg" },
 #endif
+#if ENABLE_OPUS
+	{ FORMAT_OPUS, "opus" },
+#endif
+#if ENABLE_FLAC
+	{ FORMAT_FLAC, "flac" },
+#endif
+};
+
+/* Capture device.
+ *
+ * Every device is captured by its own thread, which runs gates of all
+ * streams recorded from this device. */
+struct device {
+
+	/* device number used in the output file name */
+	unsigned int index;
+#if ENABLE_PORTAUDIO
+	int id;
+	PaStream *pa_stream;
+	/* real-time callback to capture thread buffer */
+	struct ringbuffer pa_rb;
+	/* callback statistics */
+	atomic_uint pa_overflows;
+	atomic_uint pa_overruns;
+	atomic_uint pa_late;
+#else
+	const char *name;
+	snd_pcm_t *pcm;
+#endif
+
+	/* negotiated hardware parameters */
+	unsigned int channels;
+	unsigned int rate;
+	unsigned long period_frames;
+	unsigned int periods;
+
+	/* Sample-clock timeline: the position is the number of frames captured
+	 * so far. It is anchored to the wall clock time from time to time, so
+	 * any frame can be translated to the time of its capture. */
+	uint64_t position;
+	uint64_t anchor_frame;
+	uint64_t anchor_next;
+	struct timespec anchor_time;
+	/* re-anchor with lost frames accounting */
+	bool resync;
+
+	/* timing settings in frames */
+	uint64_t fadeout_frames;
+	uint64_t split_frames;
+	uint64_t event_frames;
+	size_t window_frames;
+
+	/* signal activity detector */
+	struct detector detector;
+	/* voice activity detector */
+	struct vad vad;
+	/* tone detector bank */
+	struct tone tone;
+	/* per-channel activity used by gates */
+	const bool *active;
+
+	/* recording streams of this device */
+	struct stream *streams;
+	unsigned int streams_count;
+
+	pthread_t thread;
+
+};
+
+/* Segment of a stream recorded into a single output file. */
+struct segment {
+	/* stream frame at which the segment starts */
+	uint64_t position;
+	/* capture time of the first frame */
+	struct timespec time;
+};
+
+/* Recording stream.
+ *
+ * Every stream has its own gate, processing buffers and writer. Normally,
+ * there is only one stream with all captured channels. In the per-channel
+ * mode, every captured channel is recorded as a separate mono stream. */
+struct stream {
+
+	/* stream number used in the output file name */
+	unsigned int index;
+	/* source device of this stream */
+	struct device *device;
+	/* first channel and number of channels taken from the capture */
+	unsigned int channel;
+	unsigned int channels;
+	/* channel which triggers the gate (-1 for own channels) */
+	int trigger;
+
+	/* gate stage state (device timeline) */
+	uint64_t gate_until;
+	uint64_t gated_end;
+	uint64_t event_start;
+	bool event;
+	bool recording;
+	bool started;
+	/* buffer for extracting stream channels */
+	int16_t *scratch;
+
+	/* lock-free reader to processing buffer */
+	struct ringbuffer rb;
+	/* overflow queue for the processing buffer */
+	struct elastic overflow;
+	/* pre-trigger audio history */
+	struct ringbuffer preroll;
+	size_t preroll_frames;
+
+	/* Stream timeline: the number of frames queued by the gate stage and
+	 * the number of frames processed by the encoder stage. Segment start
+	 * markers are passed between these stages in the stream timeline. */
+	uint64_t written;
+	uint64_t processed;
+	struct ringbuffer segments;
+
+	/* encoder stage state */
+	struct writer *writer;
+	/* writer exchanged with the finalizer */
+	struct writer *pending;
+	struct writer *spare;
+	/* claimed by an encoder worker */
+	atomic_flag busy;
+	/* stream has been stopped due to an error */
+	bool failed;
+
 };
 
 /* global application settings */
@@ -79,11 +228,28 @@ static struct appconfig_t {
 	/* application banner */
 	char *banner;
 
-	/* capturing PCM device */
+	/* default capturing PCM device */
 	char pcm_device[25];
 	int pcm_device_id;
+	/* requested hardware parameters */
 	unsigned int pcm_channels;
 	unsigned int pcm_rate;
+#if !ENABLE_PORTAUDIO
+	/* use zero-copy mmap capture */
+	bool pcm_mmap;
+#endif
+
+	/* capture period size (in frames) */
+	unsigned long period_frames;
+	/* number of periods in the device buffer (0 for default) */
+	unsigned int periods;
+	/* processing buffer size (in frames) */
+	size_t buffer_frames;
+
+	/* overflow queue limits (in MiB) */
+	unsigned int overflow_memory;
+	unsigned int overflow_spill;
+	const char *spill_dir;
 
 	/* if true, run signal meter only */
 	bool signal_meter;
@@ -96,22 +262,79 @@ static struct appconfig_t {
 	enum output_format output_format;
 
 	int threshold;    /* % of max signal */
+	int *thresholds;  /* per-channel thresholds */
+	unsigned int thresholds_count;
+
+	/* signal activity detector settings */
+	enum detector_mode detector;
+	int close_threshold; /* % of max signal (-1 for open threshold) */
+	int attack_time;     /* in ms */
+	int release_time;    /* in ms */
+	int min_event_time;  /* in ms */
+	int noise_margin;    /* in dB (-1 for fixed thresholds) */
+	const char *noise_file;
+	bool vad;
 	int fadeout_time; /* in ms */
 	int split_time;   /* in s (0 disables split) */
+	int window_time;  /* in ms (0 for whole packets) */
+	int preroll_time; /* in ms (0 disables pre-roll) */
 
 	/* variable bit rate settings for encoder (bit per second) */
 	int bitrate_min;
 	int bitrate_nom;
 	int bitrate_max;
+	/* remove DC offset from the encoded signal */
+	bool dc_filter;
+
+#if ENABLE_OPUS
+	/* Opus encoder settings */
+	int opus_application;
+	int opus_bitrate;    /* in bit per second */
+	int opus_complexity; /* 0 - 10 */
+#endif
+
+#if ENABLE_FLAC
+	/* FLAC encoder settings */
+	int flac_level;      /* 0 - 8 */
+	int flac_block_size; /* in frames (0 for default) */
+#endif
 
-	/* read/write synchronization */
+	/* record every channel as a separate stream */
+	bool per_channel;
+	/* sidechain triggers: channel is gated by the source channel */
+	struct { unsigned int channel, source; } *sidechains;
+	unsigned int sidechains_count;
+
+	/* tone trigger frequencies (in Hz) and thresholds */
+	unsigned int *tone_frequencies;
+	int *tone_thresholds;
+	unsigned int tones_count;
+
+	/* capturing devices */
+	struct device *devices;
+	unsigned int devices_count;
+	/* recording streams of all devices */
+	struct stream *streams;
+	unsigned int streams_count;
+	/* number of encoder workers (0 for auto) */
+	unsigned int workers;
+	/* output I/O stage */
+	struct output_queue *oq;
+
+	/* background writer finalization */
+	struct {
+		pthread_mutex_t mutex;
+		pthread_cond_t cond;
+		bool running;
+	} finalizer;
+	/* processing thread wake-up */
 	pthread_mutex_t mutex;
 	pthread_cond_t ready;
-	int16_t *buffer;
-	/* current position */
-	size_t current;
-	/* buffer size */
-	size_t size;
+	/* wake-up sequence number and the number of waiting threads */
+	atomic_uint ready_seq;
+	atomic_uint ready_waiters;
+	/* capture has finished, drain queued data */
+	atomic_bool draining;
 
 } appconfig = {
 
@@ -121,6 +344,17 @@ static struct appconfig_t {
 	.pcm_device_id = 0,
 	.pcm_channels = 1,
 	.pcm_rate = 44100,
+#if !ENABLE_PORTAUDIO
+	.pcm_mmap = false,
+#endif
+
+	.period_frames = 4096,
+	.periods = 0,
+	.buffer_frames = 65536,
+
+	.overflow_memory = 16,
+	.overflow_spill = 0,
+	.spill_dir = NULL,
 
 	.signal_meter = false,
 	.verbose = 0,
@@ -140,13 +374,43 @@ static struct appconfig_t {
 #endif
 
 	.threshold = 2,
+
+	.detector = DETECTOR_PEAK,
+	.close_threshold = -1,
+	.attack_time = 5,
+	.release_time = 300,
+	.min_event_time = 0,
+	.noise_margin = -1,
+	.noise_file = NULL,
+	.vad = false,
 	.fadeout_time = 500,
 	.split_time = 0,
+	.window_time = 0,
+	.preroll_time = 0,
 
 	/* default compression settings */
 	.bitrate_min = 32000,
 	.bitrate_nom = 64000,
 	.bitrate_max = 128000,
+	.dc_filter = false,
+
+#if ENABLE_OPUS
+	/* speech optimized settings */
+	.opus_application = OPUS_APPLICATION_VOIP,
+	.opus_bitrate = 24000,
+	.opus_complexity = 5,
+#endif
+
+#if ENABLE_FLAC
+	.flac_level = 5,
+	.flac_block_size = 0,
+#endif
+
+	.finalizer = {
+		.mutex = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+		.running = true,
+	},
 
 };
 
@@ -163,8 +427,11 @@ static void main_loop_stop(int sig) {
 
 #if !ENABLE_PORTAUDIO
 /* Set ALSA hardware parameters. */
-static int pcm_set_hw_params(snd_pcm_t *pcm, char **msg) {
+static int pcm_set_hw_params(struct device *dev, char **msg) {
 
+	snd_pcm_t *pcm = dev->pcm;
+	snd_pcm_access_t access = appconfig.pcm_mmap ?
+		SND_PCM_ACCESS_MMAP_INTERLEAVED : SND_PCM_ACCESS_RW_INTERLEAVED;
 	snd_pcm_hw_params_t *params;
 	char buf[256];
 	int dir = 0;
@@ -176,9 +443,9 @@ static int pcm_set_hw_params(snd_pcm_t *pcm, char **msg) {
 		snprintf(buf, sizeof(buf), "Set all possible ranges: %s", snd_strerror(err));
 		goto fail;
 	}
-	if ((err = snd_pcm_hw_params_set_access(pcm, params, SND_PCM_ACCESS_RW_INTERLEAVED)) != 0) {
+	if ((err = snd_pcm_hw_params_set_access(pcm, params, access)) != 0) {
 		snprintf(buf, sizeof(buf), "Set assess type: %s: %s",
-				snd_strerror(err), snd_pcm_access_name(SND_PCM_ACCESS_RW_INTERLEAVED));
+				snd_strerror(err), snd_pcm_access_name(access));
 		goto fail;
 	}
 	if ((err = snd_pcm_hw_params_set_format(pcm, params, SND_PCM_FORMAT_S16_LE)) != 0) {
@@ -186,12 +453,23 @@ static int pcm_set_hw_params(snd_pcm_t *pcm, char **msg) {
 				snd_strerror(err), snd_pcm_format_name(SND_PCM_FORMAT_S16_LE));
 		goto fail;
 	}
-	if ((err = snd_pcm_hw_params_set_channels_near(pcm, params, &appconfig.pcm_channels)) != 0) {
-		snprintf(buf, sizeof(buf), "Set channels: %s: %d", snd_strerror(err), appconfig.pcm_channels);
+	if ((err = snd_pcm_hw_params_set_channels_near(pcm, params, &dev->channels)) != 0) {
+		snprintf(buf, sizeof(buf), "Set channels: %s: %d", snd_strerror(err), dev->channels);
 		goto fail;
 	}
-	if ((err = snd_pcm_hw_params_set_rate_near(pcm, params, &appconfig.pcm_rate, &dir)) != 0) {
-		snprintf(buf, sizeof(buf), "Set sampling rate: %s: %d", snd_strerror(err), appconfig.pcm_rate);
+	if ((err = snd_pcm_hw_params_set_rate_near(pcm, params, &dev->rate, &dir)) != 0) {
+		snprintf(buf, sizeof(buf), "Set sampling rate: %s: %d", snd_strerror(err), dev->rate);
+		goto fail;
+	}
+	dir = 0;
+	if ((err = snd_pcm_hw_params_set_period_size_near(pcm, params, &dev->period_frames, &dir)) != 0) {
+		snprintf(buf, sizeof(buf), "Set period size: %s: %lu", snd_strerror(err), dev->period_frames);
+		goto fail;
+	}
+	dir = 0;
+	if (dev->periods > 0 &&
+			(err = snd_pcm_hw_params_set_periods_near(pcm, params, &dev->periods, &dir)) != 0) {
+		snprintf(buf, sizeof(buf), "Set periods: %s: %u", snd_strerror(err), dev->periods);
 		goto fail;
 	}
 	if ((err = snd_pcm_hw_params(pcm, params)) != 0) {
@@ -199,6 +477,48 @@ static int pcm_set_hw_params(snd_pcm_t *pcm, char **msg) {
 		goto fail;
 	}
 
+	snd_pcm_uframes_t buffer_frames;
+	snd_pcm_hw_params_get_period_size(params, &dev->period_frames, &dir);
+	snd_pcm_hw_params_get_buffer_size(params, &buffer_frames);
+	dev->periods = buffer_frames / dev->period_frames;
+
+	return 0;
+
+fail:
+	if (msg != NULL)
+		*msg = strdup(buf);
+	return err;
+}
+
+/* Set ALSA software parameters. */
+static int pcm_set_sw_params(struct device *dev, char **msg) {
+
+	snd_pcm_t *pcm = dev->pcm;
+	snd_pcm_sw_params_t *params;
+	char buf[256];
+	int err;
+
+	snd_pcm_sw_params_alloca(&params);
+
+	if ((err = snd_pcm_sw_params_current(pcm, params)) != 0) {
+		snprintf(buf, sizeof(buf), "Get current params: %s", snd_strerror(err));
+		goto fail;
+	}
+	/* hardware timestamps are used for anchoring the sample clock */
+	if ((err = snd_pcm_sw_params_set_tstamp_mode(pcm, params, SND_PCM_TSTAMP_ENABLE)) != 0) {
+		snprintf(buf, sizeof(buf), "Set timestamp mode: %s", snd_strerror(err));
+		goto fail;
+	}
+	if ((err = snd_pcm_sw_params_set_tstamp_type(pcm, params,
+					SND_PCM_TSTAMP_TYPE_GETTIMEOFDAY)) != 0) {
+		snprintf(buf, sizeof(buf), "Set timestamp type: %s", snd_strerror(err));
+		goto fail;
+	}
+	if ((err = snd_pcm_sw_params(pcm, params)) != 0) {
+		snprintf(buf, sizeof(buf), "%s", snd_strerror(err));
+		goto fail;
+	}
+
 	return 0;
 
 fail:
@@ -217,13 +537,27 @@ static const char *get_output_format_name(enum output_format format) {
 	return NULL;
 }
 
-/* Print some information about the audio device and its configuration. */
+/* Print some information about audio devices and their configuration. */
 static void print_audio_info(void) {
-	printf("Selected PCM device: %s\n"
-			"Hardware parameters: %d Hz, S16LE, %d channel%s\n",
-			appconfig.pcm_device,
-			appconfig.pcm_rate,
-			appconfig.pcm_channels, appconfig.pcm_channels > 1 ? "s" : "");
+	unsigned int i;
+	for (i = 0; i < appconfig.devices_count; i++) {
+		const struct device *dev = &appconfig.devices[i];
+		printf("Selected PCM device: %s\n"
+				"Hardware parameters: %d Hz, S16LE, %d channel%s\n",
+#if ENABLE_PORTAUDIO
+				Pa_GetDeviceInfo(dev->id)->name,
+#else
+				dev->name,
+#endif
+				dev->rate,
+				dev->channels, dev->channels > 1 ? "s" : "");
+#if !ENABLE_PORTAUDIO
+		printf("Period size: %lu frames, %u periods\n",
+				dev->period_frames, dev->periods);
+#endif
+	}
+	if (appconfig.per_channel)
+		printf("Recording mode: per-channel, %u streams\n", appconfig.streams_count);
 	if (!appconfig.signal_meter)
 		printf("Output file format: %s\n",
 				get_output_format_name(appconfig.output_format));
@@ -240,6 +574,16 @@ static void print_audio_info(void) {
 				appconfig.bitrate_nom / 1000,
 				appconfig.bitrate_max / 1000);
 #endif
+#if ENABLE_OPUS
+	if (appconfig.output_format == FORMAT_OPUS)
+		printf("Output bit rate: %d kbit/s, complexity: %d, application: %s\n",
+				appconfig.opus_bitrate / 1000, appconfig.opus_complexity,
+				appconfig.opus_application == OPUS_APPLICATION_VOIP ? "voip" : "audio");
+#endif
+#if ENABLE_FLAC
+	if (appconfig.output_format == FORMAT_FLAC)
+		printf("Output compression level: %d\n", appconfig.flac_level);
+#endif
 }
 
 #if ENABLE_PORTAUDIO
@@ -261,319 +605,1569 @@ static void pa_list_devices(void) {
 }
 #endif
 
-/* Calculate max peak and amplitude RMS (based on all channels). */
-static void peak_check_S16_LE(const int16_t *buffer, size_t frames, int channels,
-		int16_t *peak, int16_t *rms) {
+/* Wake up processing threads.
+ *
+ * The sequence number is bumped before the number of waiting threads is
+ * checked, while waiting threads register themselves before checking the
+ * sequence number. Hence, either the waiting thread sees the new sequence
+ * number, or we see the waiting thread and signal it under the mutex. In
+ * the common case, when all threads are busy, the mutex is not taken. */
+static void processing_notify(bool all) {
+	atomic_fetch_add(&appconfig.ready_seq, 1);
+	if (all || atomic_load(&appconfig.ready_waiters) > 0) {
+		pthread_mutex_lock(&appconfig.mutex);
+		if (all)
+			pthread_cond_broadcast(&appconfig.ready);
+		else
+			pthread_cond_signal(&appconfig.ready);
+		pthread_mutex_unlock(&appconfig.mutex);
+	}
+}
+
+/* Queue gated frames for the processing thread.
+ *
+ * Frames are written into the lock-free processing buffer. If the processing
+ * thread is not able to keep up with the incoming data, the excess goes to
+ * the overflow queue, which grows into extra memory blocks, and which is
+ * spilled to a temporary file by the processing thread. Once anything has
+ * been queued in the overflow queue, all subsequent frames go there, until
+ * it is drained, to keep the order. We shall never wait for the processing
+ * thread here, otherwise we will introduce overrun in the capturing device. */
+static void processing_write(struct stream *s, const void *buffer, size_t frames) {
+
+	size_t n = 0;
+	size_t m = 0;
+
+	if (!elastic_pending(&s->overflow))
+		n = ringbuffer_write(&s->rb, buffer, frames);
+
+	if (n < frames && (m = elastic_write(&s->overflow,
+					(const char *)buffer + n * s->rb.frame_size, frames - n)) != frames - n &&
+			appconfig.verbose)
+		warn("Reader buffer overrun");
+
+	/* dropped frames are not a part of the stream timeline */
+	s->written += n + m;
+
+}
+
+/* Keep the most recent frames in the pre-roll history buffer. */
+static void preroll_push(struct stream *s, const int16_t *buffer, size_t frames) {
 
-	const size_t size = frames * channels;
-	int16_t abslvl;
-	int64_t sum2;
-	size_t x;
+	struct ringbuffer *rb = &s->preroll;
+	size_t excess;
 
-	*peak = 0;
-	for (x = sum2 = 0; x < size; x++) {
-		abslvl = abs(buffer[x]);
-		if (*peak < abslvl)
-			*peak = abslvl;
-		sum2 += abslvl * abslvl;
+	/* retain only the tail of a block which is longer than the pre-roll */
+	if (frames > s->preroll_frames) {
+		buffer += (frames - s->preroll_frames) * s->channels;
+		frames = s->preroll_frames;
 	}
 
-	*rms = ceil(sqrt((double)sum2 / frames));
+	/* drop the oldest frames, so the new ones will fit in */
+	if ((excess = ringbuffer_available(rb) + frames) > s->preroll_frames)
+		ringbuffer_consume(rb, excess - s->preroll_frames);
+
+	ringbuffer_write(rb, buffer, frames);
+
 }
 
-/* Process incoming audio frames. */
-static void process_audio_S16_LE(const int16_t *buffer, size_t frames, int channels) {
+/* Move the content of the pre-roll history into the processing buffer. */
+static void preroll_flush(struct stream *s) {
 
-	static struct timespec peak_time = { 0 };
-	struct timespec current_time;
+	struct ringbuffer *rb = &s->preroll;
+	size_t frames;
+	void *buffer;
 
-	int16_t signal_peak;
-	int16_t signal_rms;
+	/* the history might wrap around the end of the ring buffer */
+	while ((frames = ringbuffer_peek(rb, &buffer)) > 0) {
+		processing_write(s, buffer, frames);
+		ringbuffer_consume(rb, frames);
+	}
 
-	peak_check_S16_LE(buffer, frames, channels, &signal_peak, &signal_rms);
+}
 
-	if (appconfig.signal_meter) {
-		/* dump current peak and RMS values to the stdout */
-		printf("\rsignal peak [%%]: %3u, signal RMS [%%]: %3u\r",
-				signal_peak * 100 / 0x7ffe, signal_rms * 100 / 0x7ffe);
-		fflush(stdout);
-		return;
+/* Get stream frames from the captured frames. If the stream does not cover
+ * all captured channels, its channels are extracted into the scratch buffer,
+ * otherwise captured frames are used as they are. */
+static const int16_t *stream_frames_S16_LE(struct stream *s, const int16_t *buffer,
+		size_t frames, int channels) {
+
+	if (s->channels == (unsigned int)channels)
+		return buffer;
+
+	int16_t *dst = s->scratch;
+	size_t i;
+	unsigned int c;
+
+	buffer += s->channel;
+	for (i = 0; i < frames; i++, buffer += channels)
+		for (c = 0; c < s->channels; c++)
+			*dst++ = buffer[c];
+
+	return s->scratch;
+}
+
+/* Anchor the device timeline to the wall clock time. The given time is the
+ * moment at which given number of frames was available for reading. */
+static void device_anchor(struct device *dev, const struct timespec *ts, uint64_t avail) {
+
+	if (dev->resync && dev->anchor_next > 0) {
+		/* account frames lost due to the device overrun */
+		const int64_t ns = (ts->tv_sec - dev->anchor_time.tv_sec) * 1000000000LL +
+			(ts->tv_nsec - dev->anchor_time.tv_nsec);
+		const uint64_t expected = dev->anchor_frame + ns * dev->rate / 1000000000LL;
+		if (ns > 0 && expected > dev->position + avail)
+			dev->position = expected - avail;
 	}
 
-	/* if the max peak in the buffer is greater than the threshold, update
-	 * the last peak time */
-	if ((int)signal_peak * 100 / 0x7ffe > appconfig.threshold)
-		clock_gettime(CLOCK_MONOTONIC_RAW, &peak_time);
+	dev->anchor_frame = dev->position + avail;
+	dev->anchor_time = *ts;
+	/* correct the drift between sample clock and wall clock once a minute */
+	dev->anchor_next = dev->position + (uint64_t)dev->rate * 60;
+	dev->resync = false;
+
+}
 
-	clock_gettime(CLOCK_MONOTONIC_RAW, &current_time);
-	if ((current_time.tv_sec - peak_time.tv_sec) * 1000 +
-			(current_time.tv_nsec - peak_time.tv_nsec) / 1000000 < appconfig.fadeout_time) {
+/* Get the wall clock time at which the given device frame was captured. */
+static void device_frame_time(const struct device *dev, uint64_t frame,
+		struct timespec *ts) {
 
-		pthread_mutex_lock(&appconfig.mutex);
+	const int64_t ns = ((int64_t)frame - (int64_t)dev->anchor_frame) *
+		1000000000LL / dev->rate + dev->anchor_time.tv_nsec;
+
+	ts->tv_sec = dev->anchor_time.tv_sec + ns / 1000000000LL;
+	if ((ts->tv_nsec = ns % 1000000000LL) < 0) {
+		ts->tv_nsec += 1000000000LL;
+		ts->tv_sec--;
+	}
+
+}
+
+/* Start new segment of the stream at the current stream position. */
+static void stream_segment_start(struct stream *s, uint64_t frame) {
+
+	struct segment segment = { .position = s->written };
+	device_frame_time(s->device, frame, &segment.time);
+
+	if (ringbuffer_write(&s->segments, &segment, 1) != 1)
+		warn("Segment queue overrun [%u:%u]", s->device->index, s->index);
+
+}
+
+/* Run the gate of a single stream. Returns true if frames have been queued
+ * for the processing thread.
+ *
+ * All timing decisions are based on the device timeline, so they do not
+ * depend on the scheduling of the capture thread. */
+static bool stream_gate_S16_LE(struct stream *s, const int16_t *buffer, size_t frames) {
+
+	const struct device *dev = s->device;
+	const int channels = dev->channels;
+	const uint64_t position = dev->position;
+	unsigned int c;
+	bool trigger = false;
+	bool speech = false;
+
+	/* if there is an activity in any trigger channel, keep the gate open for
+	 * the fadeout time after this block - with the VAD enabled, the activity
+	 * has to be classified as a speech */
+	if (s->trigger != -1) {
+		trigger = dev->active[s->trigger];
+		speech = !appconfig.vad || dev->vad.speech[s->trigger];
+	}
+	else
+		for (c = s->channel; c < s->channel + s->channels; c++)
+			if (dev->active[c]) {
+				trigger = true;
+				if (!appconfig.vad || dev->vad.speech[c]) {
+					speech = true;
+					break;
+				}
+			}
+
+	if (!trigger)
+		s->event = false;
+	else {
+		if (!s->event) {
+			s->event = true;
+			s->event_start = position;
+		}
+		/* Short events (e.g. clicks) and non-speech events do not open the
+		 * gate. The beginning of the event is retained in the pre-roll history,
+		 * so it will not be lost once the event has been confirmed. */
+		if (speech && position + frames - s->event_start >= dev->event_frames)
+			s->gate_until = position + frames + dev->fadeout_frames;
+	}
+
+	if (position + frames < s->gate_until) {
+
+		if (!s->recording) {
+
+			const size_t preroll = s->preroll_frames > 0 ?
+				ringbuffer_available(&s->preroll) : 0;
+			const uint64_t start = position - preroll;
+
+			/* new output file is started if the gap in the recording is
+			 * longer than the split time */
+			if (!s->started ||
+					(dev->split_frames > 0 && start - s->gated_end > dev->split_frames))
+				stream_segment_start(s, start);
+			s->started = true;
+
+			/* Recording has just been triggered, so put the retained history
+			 * in front of the live audio. While recording, the history buffer
+			 * is not updated at all, so there is no extra copy in the steady
+			 * state. */
+			if (preroll > 0)
+				preroll_flush(s);
 
-		/* if this will happen, nothing is going to save us... */
-		if (appconfig.current == appconfig.size) {
-			appconfig.current = 0;
-			if (appconfig.verbose)
-				warn("Reader buffer overrun");
 		}
 
-		/* NOTE: The size of data returned by the pcm_read in the blocking mode is
-		 *       always equal to the requested size. So, if the reader buffer (the
-		 *       external one) is an integer multiplication of our internal buffer,
-		 *       there is no need for any fancy boundary check. However, this might
-		 *       not be true if someone is using CPU profiling tool, like cpulimit. */
-		memcpy(&appconfig.buffer[appconfig.current], buffer,
-				sizeof(int16_t) * frames * appconfig.pcm_channels);
-		appconfig.current += frames * appconfig.pcm_channels;
+		s->recording = true;
+		s->gated_end = position + frames;
+
+		processing_write(s, stream_frames_S16_LE(s, buffer, frames, channels), frames);
 
 		/* dump reader buffer usage */
-		debug("Buffer usage: %zd out of %zd", appconfig.current, appconfig.size);
+		debug("Buffer usage [%u]: %zd out of %zd", s->index,
+				ringbuffer_available(&s->rb), s->rb.size);
 
-		pthread_cond_signal(&appconfig.ready);
-		pthread_mutex_unlock(&appconfig.mutex);
+		return true;
+	}
+
+	/* Silent stream costs nothing beyond the level analysis, unless the
+	 * pre-roll history has to be maintained. */
+	s->recording = false;
+	if (s->preroll_frames > 0)
+		preroll_push(s, stream_frames_S16_LE(s, buffer, frames, channels), frames);
+
+	return false;
+}
+
+/* Process incoming audio frames. */
+static void process_audio_S16_LE(struct device *dev, const int16_t *buffer, size_t frames) {
+
+	const int channels = dev->channels;
+	int16_t signal_peak[channels];
+	int16_t signal_rms[channels];
+	bool ready = false;
+	unsigned int i;
+	int c;
+
+	if (appconfig.signal_meter) {
+		level_S16_LE(buffer, frames, channels, signal_peak, signal_rms);
+		/* dump current per-channel peak and RMS values to the stdout */
+		printf("\r");
+		if (appconfig.devices_count > 1)
+			printf("[%u] ", dev->index);
+		printf("signal peak [%%]:");
+		for (c = 0; c < channels; c++)
+			printf(" %3u", signal_peak[c] * 100 / 0x7fff);
+		printf(", signal RMS [%%]:");
+		for (c = 0; c < channels; c++)
+			printf(" %3u", signal_rms[c] * 100 / 0x7fff);
+		printf("\r");
+		fflush(stdout);
+		dev->position += frames;
+		return;
+	}
+
+	/* Analyze the signal in detection windows, so the gate can be opened or
+	 * closed at the window boundary rather than at the packet boundary.
+	 * Windows are aligned to the device timeline, so the result does not
+	 * depend on the packet size. Gated frames are queued straight from the
+	 * capture buffer, so there are no extra copies. */
+	while (frames > 0) {
+
+		size_t n = frames;
+		if (dev->window_frames > 0 &&
+				(n = dev->window_frames - dev->position % dev->window_frames) > frames)
+			n = frames;
+
+		level_S16_LE(buffer, n, channels, signal_peak, signal_rms);
+		detector_update(&dev->detector, signal_peak, signal_rms, n);
+		if (appconfig.tones_count > 0)
+			tone_update_S16_LE(&dev->tone, buffer, n);
+		if (appconfig.vad)
+			vad_update_S16_LE(&dev->vad, buffer, n, dev->active);
+
+		for (i = 0; i < dev->streams_count; i++)
+			if (stream_gate_S16_LE(&dev->streams[i], buffer, n))
+				ready = true;
+
+		dev->position += n;
+		buffer += n * channels;
+		frames -= n;
 
 	}
 
+	if (ready)
+		processing_notify(false);
+
 }
 
 #if ENABLE_PORTAUDIO
 
-/* Callback function for PortAudio capture. */
+/* Callback function for PortAudio capture.
+ *
+ * This function is called from the real-time audio thread, so it must not
+ * block, allocate memory or print anything. The only thing done here is a
+ * wait-free copy into the pre-allocated ring buffer. Signal analysis and
+ * gating are deferred to the capture thread. */
 static int pa_capture_callback(const void *inputBuffer, void *outputBuffer,
 		unsigned long framesPerBuffer, const PaStreamCallbackTimeInfo* timeInfo,
 		PaStreamCallbackFlags statusFlags, void *userData) {
 	(void)outputBuffer;
-	(void)timeInfo;
-	(void)statusFlags;
-	(void)userData;
-	process_audio_S16_LE(inputBuffer, framesPerBuffer, appconfig.pcm_channels);
+
+	struct device *dev = userData;
+
+	if (statusFlags & paInputOverflow)
+		atomic_fetch_add_explicit(&dev->pa_overflows, 1, memory_order_relaxed);
+	if (ringbuffer_write(&dev->pa_rb, inputBuffer, framesPerBuffer) != framesPerBuffer)
+		atomic_fetch_add_explicit(&dev->pa_overruns, 1, memory_order_relaxed);
+
+	/* check whether we have not exceeded the time budget of this callback */
+	if (timeInfo->currentTime > 0 &&
+			Pa_GetStreamTime(dev->pa_stream) - timeInfo->currentTime >
+			(PaTime)framesPerBuffer / dev->rate)
+		atomic_fetch_add_explicit(&dev->pa_late, 1, memory_order_relaxed);
+
 	return main_loop_on ? paContinue : paComplete;
 }
 
-#else
+/* Report PortAudio callback statistics which have changed since last call. */
+static void pa_report_callback_stats(struct device *dev, unsigned int stats[3]) {
 
-/* Thread function for ALSA capture. */
-static void *alsa_capture_thread(void *arg) {
+	const unsigned int overflows = atomic_load(&dev->pa_overflows);
+	const unsigned int overruns = atomic_load(&dev->pa_overruns);
+	const unsigned int late = atomic_load(&dev->pa_late);
+
+	if (overflows != stats[0])
+		warn("PortAudio input overflows [%u]: %u", dev->index, overflows);
+	if (overruns != stats[1])
+		warn("PortAudio callback buffer overruns [%u]: %u", dev->index, overruns);
+	if (late != stats[2])
+		warn("PortAudio callbacks over time budget [%u]: %u", dev->index, late);
 
-	int16_t *buffer = malloc(sizeof(int16_t) * appconfig.pcm_channels * READER_FRAMES);
-	snd_pcm_sframes_t frames;
-	snd_pcm_t *pcm = arg;
+	stats[0] = overflows;
+	stats[1] = overruns;
+	stats[2] = late;
+
+}
+
+/* Thread function for PortAudio capture post-processing. */
+static void *pa_capture_thread(void *arg) {
+
+	struct device *dev = arg;
+	/* poll the callback buffer twice per period */
+	const long interval = dev->period_frames * 1000 / dev->rate / 2;
+	unsigned int stats[3] = { 0 };
+	unsigned int overruns = 0;
+	struct timespec ts;
+	int16_t *buffer;
+	size_t frames;
 
 	while (main_loop_on) {
-		if ((frames = snd_pcm_readi(pcm, buffer, READER_FRAMES)) < 0)
-			switch (frames) {
-			case -EPIPE:
-			case -ESTRPIPE:
-				snd_pcm_recover(pcm, frames, 1);
-				if (appconfig.verbose)
-					warn("PCM buffer overrun: %s", snd_strerror(frames));
-				continue;
-			default:
-				error("PCM read error: %s", snd_strerror(frames));
-				continue;
-			}
-		process_audio_S16_LE(buffer, frames, appconfig.pcm_channels);
+
+		if ((frames = ringbuffer_peek(&dev->pa_rb, (void **)&buffer)) == 0) {
+			if (appconfig.verbose)
+				pa_report_callback_stats(dev, stats);
+			Pa_Sleep(interval > 0 ? interval : 1);
+			continue;
+		}
+
+		/* frames dropped by the callback have to be skipped in the timeline */
+		if (atomic_load_explicit(&dev->pa_overruns, memory_order_relaxed) != overruns) {
+			overruns = atomic_load_explicit(&dev->pa_overruns, memory_order_relaxed);
+			dev->resync = true;
+		}
+
+		/* PortAudio does not expose capture time stamps in a portable way,
+		 * so the timeline is anchored to the current wall clock time */
+		if (dev->position >= dev->anchor_next || dev->resync) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			device_anchor(dev, &ts, ringbuffer_available(&dev->pa_rb));
+		}
+
+		/* keep the analysis granularity the same as in the callback */
+		if (frames > dev->period_frames)
+			frames = dev->period_frames;
+
+		process_audio_S16_LE(dev, buffer, frames);
+		ringbuffer_consume(&dev->pa_rb, frames);
+
 	}
 
-	free(buffer);
 	return NULL;
 }
 
-#endif
+#else
 
-/* Audio signal data processing thread. */
-static void *processing_thread(void *arg) {
-	(void)arg;
+/* Recover PCM from the error state. */
+static int alsa_recover(struct device *dev, int err) {
+	switch (err) {
+	case -EPIPE:
+	case -ESTRPIPE:
+		if (appconfig.verbose)
+			warn("PCM buffer overrun: %s", snd_strerror(err));
+		if ((err = snd_pcm_recover(dev->pcm, err, 1)) != 0)
+			return err;
+		/* frames lost during the overrun have to be skipped in the timeline */
+		dev->resync = true;
+		/* the capture has to be restarted explicitly */
+		return snd_pcm_start(dev->pcm);
+	default:
+		error("PCM read error: %s", snd_strerror(err));
+		return err;
+	}
+}
 
-	if (appconfig.signal_meter)
-		return NULL;
+/* Get the number of available frames. From time to time, the device
+ * timeline is anchored to the hardware timestamp of the PCM status. */
+static snd_pcm_sframes_t alsa_avail(struct device *dev) {
 
-	int16_t *buffer = malloc(sizeof(int16_t) * appconfig.pcm_channels * PROCESSING_FRAMES);
-	size_t frames = 0;
+	if (dev->position < dev->anchor_next && !dev->resync)
+		return snd_pcm_avail(dev->pcm);
 
-	struct timespec current_time;
-	struct timespec previous_time = { 0 };
-	struct tm tmp_tm_time;
-	time_t tmp_t_time;
-	bool create_new_output = true;
-	/* it must contain a prefix and the timestamp */
-	char file_name_tmp[192];
-	char file_name[192 + 4];
+	snd_pcm_status_t *status;
+	snd_htimestamp_t ts;
+	int err;
 
-	FILE *fp = NULL;
+	snd_pcm_status_alloca(&status);
+	if ((err = snd_pcm_status(dev->pcm, status)) != 0)
+		return err;
 
-#if ENABLE_SNDFILE
-	struct writer_sndfile *writer_sndfile = NULL;
-	if (appconfig.output_format == FORMAT_WAV) {
-		if ((writer_sndfile = writer_sndfile_init(appconfig.pcm_channels, appconfig.pcm_rate,
-						SF_FORMAT_WAV | SF_FORMAT_PCM_16)) == NULL) {
-			error("Couldn't initialize sndfile writer: %s", strerror(errno));
-			exit(EXIT_FAILURE);
-		}
+	switch (snd_pcm_status_get_state(status)) {
+	case SND_PCM_STATE_XRUN:
+		return -EPIPE;
+	case SND_PCM_STATE_SUSPENDED:
+		return -ESTRPIPE;
+	default:
+		break;
 	}
-#endif
 
-#if ENABLE_MP3LAME
-	struct writer_mp3lame *writer_mp3lame = NULL;
-	if (appconfig.output_format == FORMAT_MP3) {
-		if ((writer_mp3lame = writer_mp3lame_init(appconfig.pcm_channels, appconfig.pcm_rate,
-						appconfig.bitrate_min, appconfig.bitrate_max, appconfig.banner)) == NULL) {
-			error("Couldn't initialize mp3lame writer: %s", strerror(errno));
-			exit(EXIT_FAILURE);
-		}
-		if (appconfig.verbose >= 2)
-			lame_print_internals(writer_mp3lame->gfp);
-	}
-#endif
+	const snd_pcm_uframes_t avail = snd_pcm_status_get_avail(status);
+	snd_pcm_status_get_htstamp(status, &ts);
+	/* time stamping might not be supported by the driver */
+	if (ts.tv_sec == 0 && ts.tv_nsec == 0)
+		clock_gettime(CLOCK_REALTIME, &ts);
 
-#if ENABLE_VORBIS
-	struct writer_vorbis *writer_vorbis = NULL;
-	if (appconfig.output_format == FORMAT_OGG) {
-		if ((writer_vorbis = writer_vorbis_init(appconfig.pcm_channels, appconfig.pcm_rate,
-						appconfig.bitrate_min, appconfig.bitrate_nom, appconfig.bitrate_max,
-						appconfig.banner)) == NULL) {
-			error("Couldn't initialize vorbis writer: %s", strerror(errno));
-			exit(EXIT_FAILURE);
-		}
+	device_anchor(dev, &ts, avail);
+	return avail;
+}
+
+/* Read available frames in the read/write access mode. */
+static snd_pcm_sframes_t alsa_capture_rw(struct device *dev, int16_t *buffer,
+		snd_pcm_uframes_t frames) {
+	snd_pcm_sframes_t ret;
+	if ((ret = snd_pcm_readi(dev->pcm, buffer, frames)) > 0)
+		process_audio_S16_LE(dev, buffer, ret);
+	return ret;
+}
+
+/* Read available frames with direct access to the DMA area. */
+static snd_pcm_sframes_t alsa_capture_mmap(struct device *dev,
+		snd_pcm_uframes_t frames) {
+
+	snd_pcm_t *pcm = dev->pcm;
+	const snd_pcm_channel_area_t *areas;
+	snd_pcm_uframes_t offset;
+	snd_pcm_sframes_t ret;
+
+	if ((ret = snd_pcm_mmap_begin(pcm, &areas, &offset, &frames)) < 0)
+		return ret;
+
+	/* Analyze the signal level directly in the DMA area. Only gated
+	 * audio will be copied into the processing buffer. */
+	process_audio_S16_LE(dev, (const int16_t *)((const char *)areas[0].addr +
+				(areas[0].first + offset * areas[0].step) / 8), frames);
+
+	if ((ret = snd_pcm_mmap_commit(pcm, offset, frames)) >= 0 &&
+			(snd_pcm_uframes_t)ret != frames)
+		/* partial commit means that the PCM has been overrun */
+		return -EPIPE;
+	return ret;
+}
+
+/* Thread function for ALSA capture.
+ *
+ * The PCM is opened in the non-blocking mode, so this thread sleeps on PCM
+ * poll descriptors. On every wake-up, all available frames are drained in
+ * chunks of at most one period. */
+static void *alsa_capture_thread(void *arg) {
+
+	struct device *dev = arg;
+	snd_pcm_t *pcm = dev->pcm;
+	int16_t *buffer = NULL;
+	struct pollfd *pfds;
+	unsigned short revents;
+	snd_pcm_sframes_t avail;
+	snd_pcm_sframes_t ret;
+	int nfds;
+	int err;
+
+	nfds = snd_pcm_poll_descriptors_count(pcm);
+	if ((pfds = malloc(sizeof(*pfds) * nfds)) == NULL ||
+			(!appconfig.pcm_mmap && (buffer = malloc(sizeof(int16_t) *
+					dev->channels * dev->period_frames)) == NULL)) {
+		error("Failed to allocate memory for capture buffer");
+		goto final;
 	}
-#endif
+
+	snd_pcm_poll_descriptors(pcm, pfds, nfds);
+
+	if ((err = snd_pcm_start(pcm)) < 0)
+		error("Couldn't start PCM: %s", snd_strerror(err));
 
 	while (main_loop_on) {
 
-		/* copy data from the reader buffer into our internal one */
-		pthread_mutex_lock(&appconfig.mutex);
-		if (appconfig.current == 0) /* wait until new data are available */
-			pthread_cond_wait(&appconfig.ready, &appconfig.mutex);
-		memcpy(buffer, appconfig.buffer, sizeof(int16_t) * appconfig.current);
-		frames = appconfig.current / appconfig.pcm_channels;
-		appconfig.current = 0;
-		pthread_mutex_unlock(&appconfig.mutex);
+		if (poll(pfds, nfds, 1000) == -1) {
+			if (errno == EINTR)
+				continue;
+			error("PCM poll error: %s", strerror(errno));
+			break;
+		}
 
-		/* check if new file should be created (activity time based) */
-		clock_gettime(CLOCK_MONOTONIC_RAW, &current_time);
-		if (appconfig.split_time &&
-				(current_time.tv_sec - previous_time.tv_sec) > appconfig.split_time)
-			create_new_output = true;
-		memcpy(&previous_time, &current_time, sizeof(previous_time));
+		snd_pcm_poll_descriptors_revents(pcm, pfds, nfds, &revents);
+		if (!(revents & (POLLIN | POLLERR)))
+			continue;
 
-		/* create new output file if needed */
-		if (create_new_output) {
-			create_new_output = false;
+		if ((avail = alsa_avail(dev)) < 0) {
+			alsa_recover(dev, avail);
+			continue;
+		}
 
-			tmp_t_time = time(NULL);
-			localtime_r(&tmp_t_time, &tmp_tm_time);
+		while (avail > 0) {
 
-			strftime(file_name_tmp, sizeof(file_name_tmp), appconfig.output, &tmp_tm_time);
-			snprintf(file_name, sizeof(file_name), "%s.%s",
-					file_name_tmp, get_output_format_name(appconfig.output_format));
+			snd_pcm_uframes_t frames = avail;
+			if (frames > dev->period_frames)
+				frames = dev->period_frames;
 
-			if (appconfig.verbose)
-				info("Creating new output file: %s", file_name);
+			if (appconfig.pcm_mmap)
+				ret = alsa_capture_mmap(dev, frames);
+			else
+				ret = alsa_capture_rw(dev, buffer, frames);
 
-			/* initialize new file for selected encoder */
-			switch (appconfig.output_format) {
-#if ENABLE_SNDFILE
-			case FORMAT_WAV:
-				if (writer_sndfile_open(writer_sndfile, file_name) != -1)
-					break;
-				error("Couldn't open sndfile writer: %s", strerror(errno));
-				goto fail;
-#endif
-#if ENABLE_MP3LAME
-			case FORMAT_MP3:
-				if (writer_mp3lame_open(writer_mp3lame, file_name) != -1)
-					break;
-				error("Couldn't open mp3lame writer: %s", strerror(errno));
-				goto fail;
-#endif
-#if ENABLE_VORBIS
-			case FORMAT_OGG:
-				if (writer_vorbis_open(writer_vorbis, file_name) != -1)
-					break;
-				error("Couldn't open vorbis writer: %s", strerror(errno));
-				goto fail;
-#endif
-			case FORMAT_RAW:
-				if (fp != NULL)
-					fclose(fp);
-				if ((fp = fopen(file_name, "w")) != NULL)
-					break;
-				error("Couldn't create output file: %s", strerror(errno));
-				goto fail;
+			if (ret < 0) {
+				if (ret != -EAGAIN)
+					alsa_recover(dev, ret);
+				break;
 			}
 
+			avail -= ret;
+
 		}
 
-		/* use selected encoder for data processing */
-		switch (appconfig.output_format) {
+	}
+
+final:
+	free(buffer);
+	free(pfds);
+	return NULL;
+}
+
+#endif
+
+/* Output writer for the selected output format. */
+struct writer {
+	enum output_format format;
+	unsigned int channels;
+	/* output of the currently opened file */
+	struct output *out;
+	union {
+		void *encoder;
 #if ENABLE_SNDFILE
-		case FORMAT_WAV:
-			writer_sndfile_write(writer_sndfile, buffer, frames);
-			break;
+		struct writer_sndfile *sndfile;
 #endif
 #if ENABLE_MP3LAME
-		case FORMAT_MP3:
-			writer_mp3lame_write(writer_mp3lame, buffer, frames);
-			break;
+		struct writer_mp3lame *mp3lame;
 #endif
 #if ENABLE_VORBIS
-		case FORMAT_OGG:
-			writer_vorbis_write(writer_vorbis, buffer, frames);
-			break;
+		struct writer_vorbis *vorbis;
 #endif
-		case FORMAT_RAW:
-			fwrite(buffer, sizeof(int16_t) * appconfig.pcm_channels, frames, fp);
-		}
+#if ENABLE_OPUS
+		struct writer_opus *opus;
+#endif
+#if ENABLE_FLAC
+		struct writer_flac *flac;
+#endif
+	};
+};
+
+/* Initialize writer for the given output format. */
+static struct writer *writer_init(enum output_format format, unsigned int channels,
+		unsigned int rate) {
 
+	struct writer *w;
+	if ((w = calloc(1, sizeof(*w))) == NULL) {
+		error("Couldn't initialize writer: %s", strerror(ENOMEM));
+		return NULL;
 	}
 
-fail:
+	w->format = format;
+	w->channels = channels;
+	/* not used if only the raw format is available */
+	(void)rate;
 
-	/* clean up routines for selected encoder */
-	switch (appconfig.output_format) {
+	switch (format) {
 #if ENABLE_SNDFILE
 	case FORMAT_WAV:
-		writer_sndfile_free(writer_sndfile);
-		break;
+		if ((w->sndfile = writer_sndfile_init(channels, rate,
+						SF_FORMAT_WAV | SF_FORMAT_PCM_16)) != NULL)
+			break;
+		error("Couldn't initialize sndfile writer: %s", strerror(errno));
+		goto fail;
 #endif
 #if ENABLE_MP3LAME
 	case FORMAT_MP3:
-		writer_mp3lame_free(writer_mp3lame);
-		break;
+		if ((w->mp3lame = writer_mp3lame_init(channels, rate,
+						appconfig.bitrate_min, appconfig.bitrate_max, appconfig.banner)) != NULL)
+			break;
+		error("Couldn't initialize mp3lame writer: %s", strerror(errno));
+		goto fail;
 #endif
 #if ENABLE_VORBIS
 	case FORMAT_OGG:
-		writer_vorbis_free(writer_vorbis);
+		if ((w->vorbis = writer_vorbis_init(channels, rate,
+						appconfig.bitrate_min, appconfig.bitrate_nom, appconfig.bitrate_max,
+						appconfig.dc_filter, appconfig.banner)) != NULL)
+			break;
+		error("Couldn't initialize vorbis writer: %s", strerror(errno));
+		goto fail;
+#endif
+#if ENABLE_OPUS
+	case FORMAT_OPUS:
+		if ((w->opus = writer_opus_init(channels, rate, appconfig.opus_application,
+						appconfig.opus_bitrate, appconfig.opus_complexity,
+						appconfig.banner)) != NULL)
+			break;
+		error("Couldn't initialize opus writer: %s", strerror(errno));
+		goto fail;
+#endif
+#if ENABLE_FLAC
+	case FORMAT_FLAC:
+		if ((w->flac = writer_flac_init(channels, rate, appconfig.flac_level,
+						appconfig.flac_block_size, appconfig.banner)) != NULL)
+			break;
+		error("Couldn't initialize flac writer: %s", strerror(errno));
+		goto fail;
+#endif
+	case FORMAT_RAW:
+		break;
+	}
+
+	return w;
+
+#if ENABLE_SNDFILE || ENABLE_MP3LAME || ENABLE_VORBIS || ENABLE_OPUS || ENABLE_FLAC
+fail:
+	free(w);
+	return NULL;
+#endif
+}
+
+/* Close the output file (if opened) and release writer resources. */
+static void writer_free(struct writer *w) {
+	switch (w->format) {
+#if ENABLE_SNDFILE
+	case FORMAT_WAV:
+		writer_sndfile_free(w->sndfile);
+		break;
+#endif
+#if ENABLE_MP3LAME
+	case FORMAT_MP3:
+		writer_mp3lame_free(w->mp3lame);
+		break;
+#endif
+#if ENABLE_VORBIS
+	case FORMAT_OGG:
+		writer_vorbis_free(w->vorbis);
+		break;
+#endif
+#if ENABLE_OPUS
+	case FORMAT_OPUS:
+		writer_opus_free(w->opus);
+		break;
+#endif
+#if ENABLE_FLAC
+	case FORMAT_FLAC:
+		writer_flac_free(w->flac);
 		break;
 #endif
 	case FORMAT_RAW:
-		if (fp != NULL)
-			fclose(fp);
+		if (w->out != NULL)
+			output_close(w->out);
+	}
+	free(w);
+}
+
+/* Flush encoder and close the output file. */
+static void writer_close(struct writer *w) {
+	switch (w->format) {
+#if ENABLE_SNDFILE
+	case FORMAT_WAV:
+		writer_sndfile_close(w->sndfile);
+		break;
+#endif
+#if ENABLE_MP3LAME
+	case FORMAT_MP3:
+		writer_mp3lame_close(w->mp3lame);
+		break;
+#endif
+#if ENABLE_VORBIS
+	case FORMAT_OGG:
+		writer_vorbis_close(w->vorbis);
+		break;
+#endif
+#if ENABLE_OPUS
+	case FORMAT_OPUS:
+		writer_opus_close(w->opus);
+		break;
+#endif
+#if ENABLE_FLAC
+	case FORMAT_FLAC:
+		writer_flac_close(w->flac);
+		break;
+#endif
+	case FORMAT_RAW:
+		if (w->out != NULL)
+			output_close(w->out);
+	}
+	w->out = NULL;
+}
+
+/* Start writing into the given output. The writer takes ownership of the
+ * output, even if this function fails. */
+static int writer_open(struct writer *w, struct output *out) {
+
+	writer_close(w);
+	w->out = out;
+
+	switch (w->format) {
+#if ENABLE_SNDFILE
+	case FORMAT_WAV:
+		if (writer_sndfile_open(w->sndfile, out) != -1)
+			break;
+		error("Couldn't open sndfile writer: %s", strerror(errno));
+		return -1;
+#endif
+#if ENABLE_MP3LAME
+	case FORMAT_MP3:
+		if (writer_mp3lame_open(w->mp3lame, out) != -1)
+			break;
+		error("Couldn't open mp3lame writer: %s", strerror(errno));
+		return -1;
+#endif
+#if ENABLE_VORBIS
+	case FORMAT_OGG:
+		if (writer_vorbis_open(w->vorbis, out) != -1)
+			break;
+		error("Couldn't open vorbis writer: %s", strerror(errno));
+		return -1;
+#endif
+#if ENABLE_OPUS
+	case FORMAT_OPUS:
+		if (writer_opus_open(w->opus, out) != -1)
+			break;
+		error("Couldn't open opus writer: %s", strerror(errno));
+		return -1;
+#endif
+#if ENABLE_FLAC
+	case FORMAT_FLAC:
+		if (writer_flac_open(w->flac, out) != -1)
+			break;
+		error("Couldn't open flac writer: %s", strerror(errno));
+		return -1;
+#endif
+	case FORMAT_RAW:
+		break;
+	}
+
+	return 0;
+}
+
+/* Encode and write frames into the output file. */
+static ssize_t writer_write(struct writer *w, int16_t *buffer, size_t frames) {
+	switch (w->format) {
+#if ENABLE_SNDFILE
+	case FORMAT_WAV:
+		return writer_sndfile_write(w->sndfile, buffer, frames);
+#endif
+#if ENABLE_MP3LAME
+	case FORMAT_MP3:
+		return writer_mp3lame_write(w->mp3lame, buffer, frames);
+#endif
+#if ENABLE_VORBIS
+	case FORMAT_OGG:
+		return writer_vorbis_write(w->vorbis, buffer, frames);
+#endif
+#if ENABLE_OPUS
+	case FORMAT_OPUS:
+		return writer_opus_write(w->opus, buffer, frames);
+#endif
+#if ENABLE_FLAC
+	case FORMAT_FLAC:
+		return writer_flac_write(w->flac, buffer, frames);
+#endif
+	case FORMAT_RAW:
+		return output_write(w->out, buffer, sizeof(int16_t) * w->channels * frames);
+	}
+	return -1;
+}
+
+/* Thread function for background writer finalization.
+ *
+ * Flushing the encoder, writing trailing data and closing the file might
+ * take some time. In order not to stall the encoder stage when the output
+ * file is split, this work is done here, on the retired writer instance.
+ * Afterwards, the instance is ready to be used for the next file. */
+static void *finalizer_thread(void *arg) {
+	(void)arg;
+
+	struct stream *s;
+	struct writer *w;
+	unsigned int i;
+
+	pthread_mutex_lock(&appconfig.finalizer.mutex);
+	for (;;) {
+
+		for (i = 0, s = NULL; i < appconfig.streams_count; i++)
+			if (appconfig.streams[i].pending != NULL) {
+				s = &appconfig.streams[i];
+				break;
+			}
+
+		if (s == NULL) {
+			if (!appconfig.finalizer.running)
+				break;
+			pthread_cond_wait(&appconfig.finalizer.cond, &appconfig.finalizer.mutex);
+			continue;
+		}
+
+		w = s->pending;
+		pthread_mutex_unlock(&appconfig.finalizer.mutex);
+		writer_close(w);
+		pthread_mutex_lock(&appconfig.finalizer.mutex);
+
+		s->pending = NULL;
+		s->spare = w;
+		pthread_cond_broadcast(&appconfig.finalizer.cond);
+
+	}
+	pthread_mutex_unlock(&appconfig.finalizer.mutex);
+
+	return NULL;
+}
+
+/* Hand the stream writer over to the finalizer and get the spare one in
+ * exchange. Normally, the spare writer has been finalized long ago, so the
+ * cost of this call is a pointer swap. */
+static void writer_swap(struct stream *s) {
+
+	pthread_mutex_lock(&appconfig.finalizer.mutex);
+	while (s->spare == NULL)
+		pthread_cond_wait(&appconfig.finalizer.cond, &appconfig.finalizer.mutex);
+	s->pending = s->writer;
+	s->writer = s->spare;
+	s->spare = NULL;
+	pthread_cond_broadcast(&appconfig.finalizer.cond);
+	pthread_mutex_unlock(&appconfig.finalizer.mutex);
+
+}
+
+/* Expand the output template for the given stream. The channel index
+ * conversion (%i) is replaced with the stream number and the device index
+ * conversion (%N) with the device number. All other conversions are left
+ * for strftime(). If there are many streams (or devices) and the template
+ * does not contain the corresponding index, it is appended to the name. */
+static void output_template(char *buffer, size_t size, const struct stream *s) {
+
+	const char *tmpl = appconfig.output;
+	bool expanded_channel = false;
+	bool expanded_device = false;
+	size_t len = 0;
+	int n;
+
+	while (*tmpl != '\0' && len + 1 < size) {
+		if (tmpl[0] == '%' && (tmpl[1] == 'i' || tmpl[1] == 'N')) {
+			if (tmpl[1] == 'i') {
+				n = snprintf(&buffer[len], size - len, "%u", s->index);
+				expanded_channel = true;
+			}
+			else {
+				n = snprintf(&buffer[len], size - len, "%u", s->device->index);
+				expanded_device = true;
+			}
+			len = len + n < size ? len + n : size - 1;
+			tmpl += 2;
+			continue;
+		}
+		/* copy escaped percent sign as it is */
+		if (tmpl[0] == '%' && tmpl[1] == '%')
+			buffer[len++] = *tmpl++;
+		if (len + 1 < size)
+			buffer[len++] = *tmpl++;
+	}
+	buffer[len] = '\0';
+
+	if (!expanded_device && appconfig.devices_count > 1) {
+		n = snprintf(&buffer[len], size - len, "-dev%u", s->device->index);
+		len = len + n < size ? len + n : size - 1;
+	}
+	if (!expanded_channel && s->device->streams_count > 1)
+		snprintf(&buffer[len], size - len, "-ch%u", s->index);
+
+}
+
+/* Create new output file for the given stream segment. */
+static int stream_output_open(struct stream *s, const struct segment *segment) {
+
+	struct tm tmp_tm_time;
+	/* it must contain a prefix and the timestamp */
+	char template[192];
+	char file_name_tmp[192];
+	char file_name[192 + 4];
+	struct output *out;
+
+	/* file name reflects the capture time, not the encoding time */
+	localtime_r(&segment->time.tv_sec, &tmp_tm_time);
+
+	output_template(template, sizeof(template), s);
+	strftime(file_name_tmp, sizeof(file_name_tmp), template, &tmp_tm_time);
+	snprintf(file_name, sizeof(file_name), "%s.%s",
+			file_name_tmp, get_output_format_name(appconfig.output_format));
+
+	if (appconfig.verbose)
+		info("Creating new output file: %s", file_name);
+
+	/* the file will be created by the I/O stage */
+	if ((out = output_open(appconfig.oq, file_name)) == NULL) {
+		error("Couldn't create output file: %s", strerror(errno));
+		return -1;
+	}
+
+	/* finalize previous file in the background */
+	if (s->writer->out != NULL)
+		writer_swap(s);
+
+	return writer_open(s->writer, out);
+}
+
+/* Encode data available in the stream processing buffer. Returns the number
+ * of processed frames, or -1 on error. */
+static ssize_t stream_process(struct stream *s, int16_t *overflow_buffer) {
+
+	struct segment *segment;
+	int16_t *buffer;
+	size_t frames;
+	size_t frames_max = s->overflow.block_frames;
+	bool overflow = false;
+
+	/* move excess overflow data out of memory */
+	if (elastic_pending(&s->overflow))
+		elastic_spill(&s->overflow);
+
+	/* get data from the reader buffer in place */
+	if ((frames = ringbuffer_peek(&s->rb, (void **)&buffer)) == 0) {
+		if (!elastic_pending(&s->overflow))
+			return 0;
+		/* The producer might have filled the reader buffer after the peek
+		 * above and then switched to the overflow queue. Once the overflow
+		 * is pending, nothing more is written into the reader buffer, so
+		 * if it is still empty, it is safe to take data from the overflow
+		 * queue without breaking the order. */
+		if ((frames = ringbuffer_peek(&s->rb, (void **)&buffer)) == 0) {
+			buffer = overflow_buffer;
+			overflow = true;
+		}
+	}
+
+	/* Segment markers are queued by the gate stage before the data they
+	 * refer to, so all markers for available data are visible here. */
+	while (ringbuffer_peek(&s->segments, (void **)&segment) > 0 &&
+			segment->position == s->processed) {
+		if (stream_output_open(s, segment) == -1)
+			return -1;
+		ringbuffer_consume(&s->segments, 1);
+	}
+
+	/* do not cross the start of the next segment */
+	if (ringbuffer_peek(&s->segments, (void **)&segment) > 0 &&
+			segment->position - s->processed < frames_max)
+		frames_max = segment->position - s->processed;
+
+	if (overflow)
+		frames = elastic_read(&s->overflow, buffer, frames_max);
+	else if (frames > frames_max)
+		frames = frames_max;
+
+	if (frames == 0)
+		return 0;
+
+	writer_write(s->writer, buffer, frames);
+
+	if (!overflow)
+		ringbuffer_consume(&s->rb, frames);
+	s->processed += frames;
+
+	/* the I/O stage has already reported the reason */
+	if (output_failed(s->writer->out))
+		return -1;
+
+	return frames;
+}
+
+/* Audio signal data processing thread.
+ *
+ * This is the encoder stage of the recording pipeline. Gated audio comes from
+ * capture threads (the gate stage) via stream processing buffers and encoded
+ * data are passed to the output I/O stage. In such setup, slow encoding does
+ * not stall the capture and slow file operations do not stall encoding.
+ *
+ * A fixed pool of these threads serves streams of all devices. A stream is
+ * claimed by one thread at a time, so its writer is never used concurrently.
+ * Idle streams are skipped, so the CPU usage scales with the number of
+ * active streams rather than configured ones. */
+static void *processing_thread(void *arg) {
+
+	const unsigned int id = (uintptr_t)arg;
+	int16_t *overflow_buffer;
+	size_t overflow_size = 0;
+	ssize_t frames, ret;
+	unsigned int i;
+
+	/* overflow buffer has to be able to hold a block of any stream */
+	for (i = 0; i < appconfig.streams_count; i++) {
+		const struct elastic *overflow = &appconfig.streams[i].overflow;
+		if (overflow_size < overflow->frame_size * overflow->block_frames)
+			overflow_size = overflow->frame_size * overflow->block_frames;
+	}
+
+	if ((overflow_buffer = malloc(overflow_size)) == NULL) {
+		error("Failed to allocate memory for overflow buffer");
+		exit(EXIT_FAILURE);
+	}
+
+	for (;;) {
+
+		/* Capture threads have been joined before the drain was requested,
+		 * so no more data will be queued once this flag is seen. */
+		const bool draining = atomic_load(&appconfig.draining);
+		/* data queued after this point will change the sequence number */
+		const unsigned int seq = atomic_load(&appconfig.ready_seq);
+
+		for (i = 0, frames = 0; i < appconfig.streams_count; i++) {
+
+			/* start with different streams in different threads */
+			struct stream *s = &appconfig.streams[(id + i) % appconfig.streams_count];
+			if (atomic_flag_test_and_set(&s->busy))
+				continue;
+
+			if (!s->failed) {
+				if ((ret = stream_process(s, overflow_buffer)) != -1)
+					frames += ret;
+				else {
+					/* the reason has already been reported */
+					error("Stopped recording of stream: %u:%u", s->device->index, s->index);
+					s->failed = true;
+				}
+			}
+
+			atomic_flag_clear(&s->busy);
+
+		}
+
+		if (frames == 0) {
+			/* Streams claimed by other threads will be rescanned by them,
+			 * so all queued data have been processed at this point. */
+			if (draining)
+				break;
+			/* wait until new data are available */
+			pthread_mutex_lock(&appconfig.mutex);
+			atomic_fetch_add(&appconfig.ready_waiters, 1);
+			while (atomic_load(&appconfig.ready_seq) == seq &&
+					!atomic_load(&appconfig.draining))
+				pthread_cond_wait(&appconfig.ready, &appconfig.mutex);
+			atomic_fetch_sub(&appconfig.ready_waiters, 1);
+			pthread_mutex_unlock(&appconfig.mutex);
+		}
+
+	}
+
+	free(overflow_buffer);
+	return NULL;
+}
+
+/* Parse comma-separated list of per-channel signal thresholds. */
+static int parse_thresholds(const char *arg) {
+
+	const char *ptr = arg;
+	unsigned int n = 0;
+	int *thresholds;
+	char *end;
+	long v;
+
+	do {
+		v = strtol(ptr, &end, 10);
+		if (end == ptr || v < 0 || v > 100) {
+			error("Signal level out of range [0, 100]: %s", arg);
+			return -1;
+		}
+		if ((thresholds = realloc(appconfig.thresholds, sizeof(*thresholds) * (n + 1))) == NULL) {
+			error("Couldn't parse signal level: %s", strerror(ENOMEM));
+			return -1;
+		}
+		appconfig.thresholds = thresholds;
+		appconfig.thresholds[n++] = v;
+		ptr = end + 1;
+	} while (*end == ',');
+
+	if (*end != '\0') {
+		error("Invalid signal level: %s", arg);
+		return -1;
+	}
+
+	/* the last value is used for all remaining channels */
+	appconfig.threshold = v;
+	appconfig.thresholds_count = n;
+	return 0;
+}
+
+/* Parse sidechain trigger specification: CH:SRC */
+static int parse_sidechain(const char *arg) {
+
+	unsigned int channel, source;
+	char tail;
+	void *tmp;
+
+	if (sscanf(arg, "%u:%u%c", &channel, &source, &tail) != 2 ||
+			channel == 0 || source == 0) {
+		error("Invalid sidechain specification: %s", arg);
+		return -1;
+	}
+
+	const size_t size = sizeof(*appconfig.sidechains) * (appconfig.sidechains_count + 1);
+	if ((tmp = realloc(appconfig.sidechains, size)) == NULL) {
+		error("Couldn't parse sidechain: %s", strerror(ENOMEM));
+		return -1;
+	}
+
+	appconfig.sidechains = tmp;
+	appconfig.sidechains[appconfig.sidechains_count].channel = channel - 1;
+	appconfig.sidechains[appconfig.sidechains_count].source = source - 1;
+	appconfig.sidechains_count++;
+	return 0;
+}
+
+/* Parse tone trigger specification: FREQ[:LEVEL] */
+static int parse_tone(const char *arg) {
+
+	unsigned int frequency;
+	int threshold = -1;
+	char tail;
+	void *tmp;
+
+	const int rv = sscanf(arg, "%u:%d%c", &frequency, &threshold, &tail);
+	if ((rv != 1 && rv != 2) || frequency == 0 ||
+			(rv == 2 && (threshold < 0 || threshold > 100))) {
+		error("Invalid tone specification: %s", arg);
+		return -1;
+	}
+
+	const size_t count = appconfig.tones_count + 1;
+	if ((tmp = realloc(appconfig.tone_frequencies, sizeof(*appconfig.tone_frequencies) * count)) == NULL)
+		goto fail;
+	appconfig.tone_frequencies = tmp;
+	if ((tmp = realloc(appconfig.tone_thresholds, sizeof(*appconfig.tone_thresholds) * count)) == NULL)
+		goto fail;
+	appconfig.tone_thresholds = tmp;
+
+	appconfig.tone_frequencies[appconfig.tones_count] = frequency;
+	appconfig.tone_thresholds[appconfig.tones_count] = threshold;
+	appconfig.tones_count++;
+	return 0;
+
+fail:
+	error("Couldn't parse tone: %s", strerror(ENOMEM));
+	return -1;
+}
+
+/* Add capturing device given on the command line. */
+static int device_add(const char *arg) {
+
+	struct device *devices;
+	const size_t size = sizeof(*devices) * (appconfig.devices_count + 1);
+	if ((devices = realloc(appconfig.devices, size)) == NULL) {
+		error("Couldn't add device: %s", strerror(ENOMEM));
+		return -1;
+	}
+
+	struct device *dev = &devices[appconfig.devices_count];
+	memset(dev, 0, sizeof(*dev));
+	dev->index = ++appconfig.devices_count;
+#if ENABLE_PORTAUDIO
+	dev->id = atoi(arg);
+#else
+	dev->name = arg;
+#endif
+
+	appconfig.devices = devices;
+	return 0;
+}
+
+/* Open capturing device with requested hardware parameters. */
+static int device_open(struct device *dev) {
+
+	dev->channels = appconfig.pcm_channels;
+	dev->rate = appconfig.pcm_rate;
+	dev->period_frames = appconfig.period_frames;
+	dev->periods = appconfig.periods;
+
+#if ENABLE_PORTAUDIO
+
+	PaError pa_err;
+
+	if (ringbuffer_init(&dev->pa_rb, dev->period_frames * 8,
+				sizeof(int16_t) * dev->channels) == -1) {
+		error("Failed to allocate memory for capture buffer");
+		return -1;
+	}
+
+	PaStreamParameters pa_params = {
+		.sampleFormat = paInt16,
+		.device = dev->id,
+		.channelCount = dev->channels,
+		.suggestedLatency = Pa_GetDeviceInfo(dev->id)->defaultLowInputLatency,
+		.hostApiSpecificStreamInfo = NULL,
+	};
+
+	if (dev->periods > 0)
+		pa_params.suggestedLatency = (PaTime)dev->period_frames *
+			dev->periods / dev->rate;
+
+	if ((pa_err = Pa_OpenStream(&dev->pa_stream, &pa_params, NULL, dev->rate,
+					dev->period_frames, paClipOff, pa_capture_callback, dev)) != paNoError) {
+		error("Couldn't open PortAudio stream: %d: %s", dev->id, Pa_GetErrorText(pa_err));
+		return -1;
+	}
+
+#else
+
+	char *msg;
+	int err;
+
+	if ((err = snd_pcm_open(&dev->pcm, dev->name, SND_PCM_STREAM_CAPTURE,
+					SND_PCM_NONBLOCK)) != 0) {
+		error("Couldn't open PCM device: %s: %s", dev->name, snd_strerror(err));
+		return -1;
+	}
+
+	if ((err = pcm_set_hw_params(dev, &msg)) != 0) {
+		error("Couldn't set HW parameters: %s: %s", dev->name, msg);
+		return -1;
+	}
+
+	if ((err = pcm_set_sw_params(dev, &msg)) != 0) {
+		error("Couldn't set SW parameters: %s: %s", dev->name, msg);
+		return -1;
+	}
+
+	if ((err = snd_pcm_prepare(dev->pcm)) != 0) {
+		error("Couldn't prepare PCM: %s: %s", dev->name, snd_strerror(err));
+		return -1;
+	}
+
+#endif
+
+	return 0;
+}
+
+/* Initialize recording streams for the negotiated capture configuration. */
+static int streams_init(void) {
+
+	unsigned int channels = 0;
+	unsigned int i, j, c;
+	int *thresholds;
+
+	for (i = 0; i < appconfig.devices_count; i++) {
+		const struct device *dev = &appconfig.devices[i];
+		appconfig.streams_count += appconfig.per_channel ? dev->channels : 1;
+		if (channels < dev->channels)
+			channels = dev->channels;
+	}
+
+	/* resolve signal thresholds for all captured channels */
+	if ((thresholds = malloc(sizeof(*thresholds) * channels)) == NULL)
+		goto fail_enomem;
+	for (c = 0; c < channels; c++)
+		thresholds[c] = c < appconfig.thresholds_count ?
+			appconfig.thresholds[c] : appconfig.threshold;
+	free(appconfig.thresholds);
+	appconfig.thresholds = thresholds;
+	appconfig.thresholds_count = channels;
+
+	/* tones without explicit threshold use the default signal level */
+	for (j = 0; j < appconfig.tones_count; j++)
+		if (appconfig.tone_thresholds[j] == -1)
+			appconfig.tone_thresholds[j] = appconfig.threshold;
+
+	if ((appconfig.streams = calloc(appconfig.streams_count,
+					sizeof(*appconfig.streams))) == NULL)
+		goto fail_enomem;
+
+	struct stream *s = appconfig.streams;
+	for (i = 0; i < appconfig.devices_count; i++) {
+
+		struct device *dev = &appconfig.devices[i];
+		dev->streams = s;
+		dev->streams_count = appconfig.per_channel ? dev->channels : 1;
+		dev->fadeout_frames = (uint64_t)appconfig.fadeout_time * dev->rate / 1000;
+		dev->split_frames = (uint64_t)appconfig.split_time * dev->rate;
+		dev->event_frames = (uint64_t)appconfig.min_event_time * dev->rate / 1000;
+		dev->window_frames = (size_t)appconfig.window_time * dev->rate / 1000;
+		if (appconfig.window_time > 0 && dev->window_frames == 0)
+			dev->window_frames = 1;
+
+#if ENABLE_OPUS
+		/* the device might not support the requested rate exactly */
+		if (appconfig.output_format == FORMAT_OPUS &&
+				dev->rate != 8000 && dev->rate != 12000 && dev->rate != 16000 &&
+				dev->rate != 24000 && dev->rate != 48000) {
+			error("Unsupported Opus sampling rate: %u Hz "
+					"(Opus requires 8/12/16/24/48 kHz, use -R 48000)", dev->rate);
+			return -1;
+		}
+#endif
+
+		if (detector_init(&dev->detector, appconfig.detector, dev->channels, dev->rate,
+					appconfig.attack_time, appconfig.release_time,
+					appconfig.thresholds, appconfig.close_threshold) == -1)
+			goto fail_enomem;
+		if (appconfig.noise_margin >= 0)
+			detector_set_adaptive(&dev->detector, appconfig.noise_margin);
+		if (appconfig.vad &&
+				vad_init(&dev->vad, dev->channels, dev->rate) == -1)
+			goto fail_enomem;
+
+		/* with tone triggers, the general loudness does not open gates */
+		dev->active = dev->detector.active;
+		if (appconfig.tones_count > 0) {
+			for (j = 0; j < appconfig.tones_count; j++)
+				if (appconfig.tone_frequencies[j] >= dev->rate / 2) {
+					error("Tone frequency out of range [1, %u]: %u",
+							dev->rate / 2 - 1, appconfig.tone_frequencies[j]);
+					return -1;
+				}
+			if (tone_init(&dev->tone, dev->channels, dev->rate, appconfig.tone_frequencies,
+						appconfig.tone_thresholds, appconfig.tones_count) == -1)
+				goto fail_enomem;
+			dev->active = dev->tone.active;
+		}
+
+		/* processing buffer has to be able to hold at least two periods */
+		size_t buffer_frames = appconfig.buffer_frames;
+		if (buffer_frames < dev->period_frames * 2)
+			buffer_frames = dev->period_frames * 2;
+
+		for (j = 0; j < dev->streams_count; j++, s++) {
+
+			s->index = j + 1;
+			s->device = dev;
+			s->channel = appconfig.per_channel ? j : 0;
+			s->channels = appconfig.per_channel ? 1 : dev->channels;
+			s->trigger = -1;
+			/* pre-roll history has to cover the minimal event length and the
+			 * speech confirmation delay as well */
+			s->preroll_frames = (size_t)(appconfig.preroll_time + appconfig.min_event_time +
+					(appconfig.vad ? VAD_DELAY_MS : 0)) * dev->rate / 1000;
+			atomic_flag_clear(&s->busy);
+
+			const size_t frame_size = sizeof(int16_t) * s->channels;
+
+			if (s->channels != dev->channels &&
+					(s->scratch = malloc(frame_size * dev->period_frames)) == NULL)
+				goto fail_enomem;
+
+			/* processing buffer has to be able to absorb the whole pre-roll history */
+			if (ringbuffer_init(&s->rb, buffer_frames + s->preroll_frames, frame_size) == -1) {
+				error("Failed to allocate memory for read buffer");
+				return -1;
+			}
+
+			/* Overflow memory is reserved in blocks of 16 periods. The memory and
+			 * spill file limits are shared evenly by all streams. */
+			const size_t overflow_block_frames = dev->period_frames * 16;
+			const size_t overflow_block_size = overflow_block_frames * frame_size;
+			if (elastic_init(&s->overflow, frame_size, overflow_block_frames,
+						((size_t)appconfig.overflow_memory << 20) / appconfig.streams_count /
+						overflow_block_size,
+						((off_t)appconfig.overflow_spill << 20) / appconfig.streams_count,
+						appconfig.spill_dir) == -1) {
+				error("Failed to initialize overflow queue: %s", strerror(errno));
+				return -1;
+			}
+
+			if (s->preroll_frames > 0 &&
+					ringbuffer_init(&s->preroll, s->preroll_frames, frame_size) == -1) {
+				error("Failed to allocate memory for pre-roll buffer");
+				return -1;
+			}
+
+			if (ringbuffer_init(&s->segments, 64, sizeof(struct segment)) == -1)
+				goto fail_enomem;
+
+		}
+
+		for (j = 0; j < appconfig.sidechains_count; j++) {
+			const unsigned int channel = appconfig.sidechains[j].channel;
+			const unsigned int source = appconfig.sidechains[j].source;
+			if (channel >= dev->channels || source >= dev->channels) {
+				error("Sidechain channel out of range [1, %u]: %u:%u",
+						dev->channels, channel + 1, source + 1);
+				return -1;
+			}
+			dev->streams[channel].trigger = source;
+		}
+
+	}
+
+	return 0;
+
+fail_enomem:
+	error("Couldn't initialize recording streams: %s", strerror(ENOMEM));
+	return -1;
+}
+
+/* Restore noise floor estimation from the previous run. */
+static int noise_floor_load(const char *path) {
+
+	unsigned int device, channel;
+	float floor;
+	FILE *f;
+
+	if ((f = fopen(path, "r")) == NULL) {
+		/* missing file is not an error, it will be created on exit */
+		if (errno == ENOENT)
+			return 0;
+		error("Couldn't open noise floor file: %s", strerror(errno));
+		return -1;
+	}
+
+	/* every line holds device number, channel number and the noise floor in
+	 * dBFS, entries for not existing devices or channels are ignored */
+	while (fscanf(f, "%u %u %f", &device, &channel, &floor) == 3)
+		if (device >= 1 && device <= appconfig.devices_count &&
+				channel >= 1 && channel <= appconfig.devices[device - 1].channels) {
+			appconfig.devices[device - 1].detector.floor[channel - 1] = floor;
+			debug("Restored noise floor [%u:%u]: %.1f dBFS", device, channel, floor);
+		}
+
+	fclose(f);
+	return 0;
+}
+
+/* Save noise floor estimation for the next run. */
+static int noise_floor_save(const char *path) {
+
+	unsigned int i, c;
+	FILE *f;
+
+	if ((f = fopen(path, "w")) == NULL) {
+		error("Couldn't create noise floor file: %s", strerror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < appconfig.devices_count; i++) {
+		const struct device *dev = &appconfig.devices[i];
+		for (c = 0; c < dev->channels; c++)
+			if (!isnan(dev->detector.floor[c]))
+				fprintf(f, "%u %u %.2f\n", dev->index, c + 1, dev->detector.floor[c]);
+	}
+
+	if (fclose(f) != 0) {
+		error("Couldn't save noise floor file: %s", strerror(errno));
+		return -1;
 	}
 
-	free(buffer);
 	return 0;
 }
 
 int main(int argc, char *argv[]) {
 
+	enum {
+		OPT_PERIOD_SIZE = 0x100,
+		OPT_PERIODS,
+		OPT_BUFFER_SIZE,
+		OPT_OVERFLOW_MEMORY,
+		OPT_OVERFLOW_SPILL,
+		OPT_SPILL_DIR,
+		OPT_PER_CHANNEL,
+		OPT_SIDECHAIN,
+		OPT_WORKERS,
+		OPT_WINDOW,
+		OPT_DETECTOR,
+		OPT_CLOSE_LEVEL,
+		OPT_ATTACK,
+		OPT_RELEASE,
+		OPT_MIN_EVENT,
+		OPT_NOISE_MARGIN,
+		OPT_NOISE_FILE,
+		OPT_VAD,
+		OPT_TONE,
+		OPT_DC_FILTER,
+		OPT_OPUS_APPLICATION,
+		OPT_OPUS_BITRATE,
+		OPT_OPUS_COMPLEXITY,
+		OPT_FLAC_LEVEL,
+		OPT_FLAC_BLOCK_SIZE,
+	};
+
 	int opt;
 	size_t i;
-	const char *opts = "hVvLD:R:C:l:f:o:s:m";
+	const char *opts = "hVvLD:MR:C:l:f:p:o:s:m";
 	const struct option longopts[] = {
 		{"help", no_argument, NULL, 'h'},
 		{"version", no_argument, NULL, 'V'},
 		{"verbose", no_argument, NULL, 'v'},
 		{"list-devices", no_argument, NULL, 'L'},
 		{"device", required_argument, NULL, 'D'},
+		{"mmap", no_argument, NULL, 'M'},
 		{"channels", required_argument, NULL, 'C'},
 		{"rate", required_argument, NULL, 'R'},
 		{"sig-level", required_argument, NULL, 'l'},
 		{"fadeout-lag", required_argument, NULL, 'f'},
+		{"pre-roll", required_argument, NULL, 'p'},
 		{"out-format", required_argument, NULL, 'o'},
 		{"split-time", required_argument, NULL, 's'},
 		{"sig-meter", no_argument, NULL, 'm'},
+		{"period-size", required_argument, NULL, OPT_PERIOD_SIZE},
+		{"periods", required_argument, NULL, OPT_PERIODS},
+		{"buffer-size", required_argument, NULL, OPT_BUFFER_SIZE},
+		{"overflow-memory", required_argument, NULL, OPT_OVERFLOW_MEMORY},
+		{"overflow-spill", required_argument, NULL, OPT_OVERFLOW_SPILL},
+		{"spill-dir", required_argument, NULL, OPT_SPILL_DIR},
+		{"per-channel", no_argument, NULL, OPT_PER_CHANNEL},
+		{"sidechain", required_argument, NULL, OPT_SIDECHAIN},
+		{"workers", required_argument, NULL, OPT_WORKERS},
+		{"window", required_argument, NULL, OPT_WINDOW},
+		{"detector", required_argument, NULL, OPT_DETECTOR},
+		{"close-level", required_argument, NULL, OPT_CLOSE_LEVEL},
+		{"attack", required_argument, NULL, OPT_ATTACK},
+		{"release", required_argument, NULL, OPT_RELEASE},
+		{"min-event", required_argument, NULL, OPT_MIN_EVENT},
+		{"noise-margin", required_argument, NULL, OPT_NOISE_MARGIN},
+		{"noise-file", required_argument, NULL, OPT_NOISE_FILE},
+		{"vad", no_argument, NULL, OPT_VAD},
+		{"tone", required_argument, NULL, OPT_TONE},
+		{"dc-filter", no_argument, NULL, OPT_DC_FILTER},
+#if ENABLE_OPUS
+		{"opus-application", required_argument, NULL, OPT_OPUS_APPLICATION},
+		{"opus-bitrate", required_argument, NULL, OPT_OPUS_BITRATE},
+		{"opus-complexity", required_argument, NULL, OPT_OPUS_COMPLEXITY},
+#endif
+#if ENABLE_FLAC
+		{"flac-level", required_argument, NULL, OPT_FLAC_LEVEL},
+		{"flac-block-size", required_argument, NULL, OPT_FLAC_BLOCK_SIZE},
+#endif
 		{0, 0, 0, 0},
 	};
 
@@ -602,18 +2196,66 @@ int main(int argc, char *argv[]) {
 					"  -D ID, --device=ID\t\tselect audio input device (current: %d)\n"
 #else
 					"  -D DEV, --device=DEV\t\tselect audio input device (current: %s)\n"
+					"  -M, --mmap\t\t\tuse zero-copy mmap capture mode\n"
 #endif
 					"  -R NN, --rate=NN\t\tset sample rate (current: %u)\n"
 					"  -C NN, --channels=NN\t\tspecify number of channels (current: %u)\n"
-					"  -l NN, --sig-level=NN\t\tactivation signal threshold (current: %u)\n"
+					"  -l NN, --sig-level=NN[,NN]\tactivation signal threshold (current: %u)\n"
 					"  -f NN, --fadeout-lag=NN\tfadeout time lag in ms (current: %u)\n"
+					"  -p NN, --pre-roll=NN\t\tpre-trigger audio time in ms (current: %d)\n"
 					"  -s NN, --split-time=NN\tsplit output file time in s (current: %d)\n"
 					"  -o FMT, --out-format=FMT\toutput file format (current: %s)\n"
 					"  -m, --sig-meter\t\taudio signal level meter\n"
+					"      --period-size=NN\t\tcapture period size in frames (current: %lu)\n"
+					"      --periods=NN\t\tnumber of periods in the device buffer\n"
+					"      --buffer-size=NN\t\tprocessing buffer size in frames (current: %zu)\n"
+					"      --overflow-memory=NN\toverflow memory limit in MiB (current: %u)\n"
+					"      --overflow-spill=NN\toverflow spill file limit in MiB (current: %u)\n"
+					"      --spill-dir=DIR\t\tdirectory for the overflow spill file\n"
+					"      --per-channel\t\trecord every channel into separate files\n"
+					"      --sidechain=CH:SRC\tgate channel CH with channel SRC\n"
+					"      --workers=NN\t\tnumber of encoder threads (0 for auto)\n"
+					"      --window=NN\t\tsignal detection window in ms (current: %d)\n"
+					"      --detector=TYPE\t\tsignal detector [peak, envelope] (current: %s)\n"
+					"      --close-level=NN\tenvelope detector close threshold\n"
+					"      --attack=NN\t\tenvelope attack time in ms (current: %d)\n"
+					"      --release=NN\t\tenvelope release time in ms (current: %d)\n"
+					"      --min-event=NN\t\tminimal event length in ms (current: %d)\n"
+					"      --noise-margin=NN\tadaptive threshold above the noise floor in dB\n"
+					"      --noise-file=FILE\tfile for storing the noise floor estimation\n"
+					"      --vad\t\t\trecord only when speech is detected\n"
+					"      --tone=FREQ[:LEVEL]\trecord when tone of given frequency is detected\n"
+					"      --dc-filter\t\tremove DC offset from the encoded signal (OGG)\n"
+#if ENABLE_OPUS
+					"      --opus-application=TYPE\tOpus application [voip, audio]\n"
+					"      --opus-bitrate=NN\tOpus bit rate in kbit/s (current: %d)\n"
+					"      --opus-complexity=NN\tOpus complexity [0-10] (current: %d)\n"
+#endif
+#if ENABLE_FLAC
+					"      --flac-level=NN\t\tFLAC compression level [0-8] (current: %d)\n"
+					"      --flac-block-size=NN\tFLAC block size in frames (0 for default)\n"
+#endif
 					"\n"
 					"The output-template argument is a strftime(3) format string which\n"
 					"will be used for creating output file name. If not specified, the\n"
-					"default value is: %s + extension\n",
+					"default value is: %s + extension\n"
+					"\n"
+					"Signal level might be given for every channel as a comma-separated\n"
+					"list, the last value applies to all remaining channels. In the per-\n"
+					"channel mode, %%i in the output-template is replaced with the channel\n"
+					"number (channels are numbered from 1).\n"
+					"\n"
+					"The device option might be given many times in order to record from\n"
+					"many devices at once. In such case, %%N in the output-template is\n"
+					"replaced with the device number (in the command line order).\n"
+					"\n"
+					"With the noise-margin option, the signal level option is ignored and\n"
+					"the activation threshold follows the noise floor (a low percentile of\n"
+					"the signal RMS) with the given margin.\n"
+					"\n"
+					"The tone option might be given many times. If any tone is configured,\n"
+					"the recording is triggered by tones instead of the signal level. The\n"
+					"tone level defaults to the signal level.\n",
 					argv[0],
 #if ENABLE_PORTAUDIO
 					appconfig.pcm_device_id,
@@ -624,8 +2266,25 @@ int main(int argc, char *argv[]) {
 					appconfig.pcm_channels,
 					appconfig.threshold,
 					appconfig.fadeout_time,
+					appconfig.preroll_time,
 					appconfig.split_time,
 					get_output_format_name(appconfig.output_format),
+					appconfig.period_frames,
+					appconfig.buffer_frames,
+					appconfig.overflow_memory,
+					appconfig.overflow_spill,
+					appconfig.window_time,
+					appconfig.detector == DETECTOR_ENVELOPE ? "envelope" : "peak",
+					appconfig.attack_time,
+					appconfig.release_time,
+					appconfig.min_event_time,
+#if ENABLE_OPUS
+					appconfig.opus_bitrate / 1000,
+					appconfig.opus_complexity,
+#endif
+#if ENABLE_FLAC
+					appconfig.flac_level,
+#endif
 					appconfig.output);
 			return EXIT_SUCCESS;
 
@@ -645,11 +2304,16 @@ int main(int argc, char *argv[]) {
 			pa_list_devices();
 			return EXIT_SUCCESS;
 		case 'D' /* --device=ID */ :
-			appconfig.pcm_device_id = atoi(optarg);
+			if (device_add(optarg) == -1)
+				return EXIT_FAILURE;
 			break;
 #else
 		case 'D' /* --device=DEV */ :
-			strncpy(appconfig.pcm_device, optarg, sizeof(appconfig.pcm_device) - 1);
+			if (device_add(optarg) == -1)
+				return EXIT_FAILURE;
+			break;
+		case 'M' /* --mmap */ :
+			appconfig.pcm_mmap = true;
 			break;
 #endif
 
@@ -676,11 +2340,8 @@ int main(int argc, char *argv[]) {
 			break;
 
 		case 'l' /* --sig-level */ :
-			appconfig.threshold = atoi(optarg);
-			if (appconfig.threshold < 0 || appconfig.threshold > 100) {
-				error("Signal level out of range [0, 100]: %d", appconfig.threshold);
+			if (parse_thresholds(optarg) == -1)
 				return EXIT_FAILURE;
-			}
 			break;
 		case 'f' /* --fadeout-lag */ :
 			appconfig.fadeout_time = atoi(optarg);
@@ -689,6 +2350,13 @@ int main(int argc, char *argv[]) {
 				return EXIT_FAILURE;
 			}
 			break;
+		case 'p' /* --pre-roll */ :
+			appconfig.preroll_time = atoi(optarg);
+			if (appconfig.preroll_time < 0 || appconfig.preroll_time > 60000) {
+				error("Pre-roll time out of range [0, 60000]: %d", appconfig.preroll_time);
+				return EXIT_FAILURE;
+			}
+			break;
 		case 's' /* --split-time */ :
 			appconfig.split_time = atoi(optarg);
 			if (appconfig.split_time < 0 || appconfig.split_time > 1000000) {
@@ -697,6 +2365,167 @@ int main(int argc, char *argv[]) {
 			}
 			break;
 
+		case OPT_PERIOD_SIZE /* --period-size */ :
+			appconfig.period_frames = strtoul(optarg, NULL, 10);
+			if (appconfig.period_frames < 32 || appconfig.period_frames > 65536) {
+				error("Period size out of range [32, 65536]: %lu", appconfig.period_frames);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_PERIODS /* --periods */ :
+			appconfig.periods = atoi(optarg);
+			if (appconfig.periods < 2 || appconfig.periods > 1024) {
+				error("Number of periods out of range [2, 1024]: %u", appconfig.periods);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_BUFFER_SIZE /* --buffer-size */ :
+			appconfig.buffer_frames = strtoul(optarg, NULL, 10);
+			if (appconfig.buffer_frames < 1024 || appconfig.buffer_frames > 16777216) {
+				error("Buffer size out of range [1024, 16777216]: %zu", appconfig.buffer_frames);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_OVERFLOW_MEMORY /* --overflow-memory */ :
+			appconfig.overflow_memory = atoi(optarg);
+			if (appconfig.overflow_memory > 4096) {
+				error("Overflow memory limit out of range [0, 4096]: %u", appconfig.overflow_memory);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_OVERFLOW_SPILL /* --overflow-spill */ :
+			appconfig.overflow_spill = atoi(optarg);
+			if (appconfig.overflow_spill > 1048576) {
+				error("Overflow spill limit out of range [0, 1048576]: %u", appconfig.overflow_spill);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_SPILL_DIR /* --spill-dir */ :
+			appconfig.spill_dir = optarg;
+			break;
+		case OPT_PER_CHANNEL /* --per-channel */ :
+			appconfig.per_channel = true;
+			break;
+		case OPT_SIDECHAIN /* --sidechain */ :
+			if (parse_sidechain(optarg) == -1)
+				return EXIT_FAILURE;
+			break;
+		case OPT_DETECTOR /* --detector */ :
+			if (strcasecmp(optarg, "peak") == 0)
+				appconfig.detector = DETECTOR_PEAK;
+			else if (strcasecmp(optarg, "envelope") == 0)
+				appconfig.detector = DETECTOR_ENVELOPE;
+			else {
+				error("Unknown signal detector [peak, envelope]: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_CLOSE_LEVEL /* --close-level */ :
+			appconfig.close_threshold = atoi(optarg);
+			if (appconfig.close_threshold < 0 || appconfig.close_threshold > 100) {
+				error("Close level out of range [0, 100]: %d", appconfig.close_threshold);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_ATTACK /* --attack */ :
+			appconfig.attack_time = atoi(optarg);
+			if (appconfig.attack_time < 0 || appconfig.attack_time > 10000) {
+				error("Attack time out of range [0, 10000]: %d", appconfig.attack_time);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_RELEASE /* --release */ :
+			appconfig.release_time = atoi(optarg);
+			if (appconfig.release_time < 0 || appconfig.release_time > 10000) {
+				error("Release time out of range [0, 10000]: %d", appconfig.release_time);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_MIN_EVENT /* --min-event */ :
+			appconfig.min_event_time = atoi(optarg);
+			if (appconfig.min_event_time < 0 || appconfig.min_event_time > 10000) {
+				error("Minimal event length out of range [0, 10000]: %d", appconfig.min_event_time);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_NOISE_MARGIN /* --noise-margin */ :
+			appconfig.noise_margin = atoi(optarg);
+			if (appconfig.noise_margin < 0 || appconfig.noise_margin > 60) {
+				error("Noise margin out of range [0, 60]: %d", appconfig.noise_margin);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_NOISE_FILE /* --noise-file */ :
+			appconfig.noise_file = optarg;
+			break;
+		case OPT_VAD /* --vad */ :
+			appconfig.vad = true;
+			break;
+#if ENABLE_OPUS
+		case OPT_OPUS_APPLICATION /* --opus-application */ :
+			if (strcasecmp(optarg, "voip") == 0)
+				appconfig.opus_application = OPUS_APPLICATION_VOIP;
+			else if (strcasecmp(optarg, "audio") == 0)
+				appconfig.opus_application = OPUS_APPLICATION_AUDIO;
+			else {
+				error("Unknown Opus application [voip, audio]: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_OPUS_BITRATE /* --opus-bitrate */ :
+			appconfig.opus_bitrate = atoi(optarg) * 1000;
+			if (appconfig.opus_bitrate < 6000 || appconfig.opus_bitrate > 510000) {
+				error("Opus bit rate out of range [6, 510]: %d", appconfig.opus_bitrate / 1000);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_OPUS_COMPLEXITY /* --opus-complexity */ :
+			appconfig.opus_complexity = atoi(optarg);
+			if (appconfig.opus_complexity < 0 || appconfig.opus_complexity > 10) {
+				error("Opus complexity out of range [0, 10]: %d", appconfig.opus_complexity);
+				return EXIT_FAILURE;
+			}
+			break;
+#endif
+#if ENABLE_FLAC
+		case OPT_FLAC_LEVEL /* --flac-level */ :
+			appconfig.flac_level = atoi(optarg);
+			if (appconfig.flac_level < 0 || appconfig.flac_level > 8) {
+				error("FLAC compression level out of range [0, 8]: %d", appconfig.flac_level);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_FLAC_BLOCK_SIZE /* --flac-block-size */ :
+			appconfig.flac_block_size = atoi(optarg);
+			if (appconfig.flac_block_size != 0 &&
+					(appconfig.flac_block_size < 16 || appconfig.flac_block_size > 65535)) {
+				error("FLAC block size out of range [16, 65535]: %d", appconfig.flac_block_size);
+				return EXIT_FAILURE;
+			}
+			break;
+#endif
+		case OPT_DC_FILTER /* --dc-filter */ :
+			appconfig.dc_filter = true;
+			break;
+		case OPT_TONE /* --tone */ :
+			if (parse_tone(optarg) == -1)
+				return EXIT_FAILURE;
+			break;
+		case OPT_WINDOW /* --window */ :
+			appconfig.window_time = atoi(optarg);
+			if (appconfig.window_time < 0 || appconfig.window_time > 1000) {
+				error("Detection window out of range [0, 1000]: %d", appconfig.window_time);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_WORKERS /* --workers */ :
+			appconfig.workers = atoi(optarg);
+			if (appconfig.workers > 64) {
+				error("Number of encoder threads out of range [0, 64]: %u", appconfig.workers);
+				return EXIT_FAILURE;
+			}
+			break;
+
 		default:
 			fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
 			return EXIT_FAILURE;
@@ -705,105 +2534,195 @@ int main(int argc, char *argv[]) {
 	if (optind < argc)
 		appconfig.output = argv[optind];
 
+	if (appconfig.sidechains_count > 0 && !appconfig.per_channel) {
+		error("Sidechain trigger requires per-channel mode");
+		return EXIT_FAILURE;
+	}
+
 	/* print application banner */
 	printf("%s\n", appconfig.banner);
 
-#if !ENABLE_PORTAUDIO
-	pthread_t thread_alsa_capture_id;
-#endif
-	pthread_t thread_process_id;
+	pthread_t thread_finalizer_id;
+	pthread_t *threads_process_id = NULL;
+	unsigned int workers = 0;
 	int err;
 
+	/* use the default device, if none was given */
+#if ENABLE_PORTAUDIO
+	if (appconfig.devices_count == 0) {
+		if (device_add("") == -1)
+			return EXIT_FAILURE;
+		appconfig.devices[0].id = appconfig.pcm_device_id;
+	}
+#else
+	if (appconfig.devices_count == 0 &&
+			device_add(appconfig.pcm_device) == -1)
+		return EXIT_FAILURE;
+#endif
+
+	for (i = 0; i < appconfig.devices_count; i++)
+		if (device_open(&appconfig.devices[i]) == -1)
+			return EXIT_FAILURE;
+
 	/* initialize reader data */
 	pthread_mutex_init(&appconfig.mutex, NULL);
 	pthread_cond_init(&appconfig.ready, NULL);
-	appconfig.size = appconfig.pcm_channels * PROCESSING_FRAMES;
-	appconfig.buffer = malloc(sizeof(int16_t) * appconfig.size);
-	appconfig.current = 0;
-
-	if (appconfig.buffer == NULL) {
-		error("Failed to allocate memory for read buffer");
+	atomic_init(&appconfig.ready_seq, 0);
+	atomic_init(&appconfig.ready_waiters, 0);
+	atomic_init(&appconfig.draining, false);
+	if (streams_init() == -1)
 		return EXIT_FAILURE;
-	}
-
-#if ENABLE_PORTAUDIO
-
-	PaStream *pa_stream = NULL;
-	PaStreamParameters pa_params = {
-		.sampleFormat = paInt16,
-		.device = appconfig.pcm_device_id,
-		.channelCount = appconfig.pcm_channels,
-		.suggestedLatency = Pa_GetDeviceInfo(appconfig.pcm_device_id)->defaultLowInputLatency,
-		.hostApiSpecificStreamInfo = NULL,
-	};
 
-	if ((pa_err = Pa_OpenStream(&pa_stream, &pa_params, NULL, appconfig.pcm_rate,
-					READER_FRAMES, paClipOff, pa_capture_callback, NULL)) != paNoError) {
-		error("Couldn't open PortAudio stream: %s", Pa_GetErrorText(pa_err));
+	if (appconfig.noise_margin >= 0 && appconfig.noise_file != NULL &&
+			noise_floor_load(appconfig.noise_file) == -1)
 		return EXIT_FAILURE;
-	}
 
-#else
-
-	snd_pcm_t *pcm;
-	char *msg;
+	level_init();
 
-	if ((err = snd_pcm_open(&pcm, appconfig.pcm_device, SND_PCM_STREAM_CAPTURE, 0)) != 0) {
-		error("Couldn't open PCM device: %s", snd_strerror(err));
-		return EXIT_FAILURE;
+	if (appconfig.verbose) {
+		print_audio_info();
+		info("Signal level kernel: %s", level_kernel_name());
 	}
 
-	if ((err = pcm_set_hw_params(pcm, &msg)) != 0) {
-		error("Couldn't set HW parameters: %s", msg);
-		return EXIT_FAILURE;
-	}
+	if (!appconfig.signal_meter) {
 
-	if ((err = snd_pcm_prepare(pcm)) != 0) {
-		error("Couldn't prepare PCM: %s", snd_strerror(err));
-		return EXIT_FAILURE;
-	}
+		/* one encoder thread per stream at most, there is no gain otherwise */
+		if ((workers = appconfig.workers) == 0) {
+			const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+			workers = cpus > 0 ? cpus : 1;
+		}
+		if (workers > appconfig.streams_count)
+			workers = appconfig.streams_count;
 
+		for (i = 0; i < appconfig.streams_count; i++) {
+			struct stream *s = &appconfig.streams[i];
+			if ((s->writer = writer_init(appconfig.output_format, s->channels,
+							s->device->rate)) == NULL)
+				return EXIT_FAILURE;
+			/* Spare writer instance is used only when the output is split. It is
+			 * prepared ahead of time, so the split does not require
+			 * re-initialization of the encoder in the hot path. */
+			if (appconfig.split_time &&
+					(s->spare = writer_init(appconfig.output_format, s->channels,
+						s->device->rate)) == NULL)
+				return EXIT_FAILURE;
+		}
+
+#if ENABLE_MP3LAME
+		if (appconfig.output_format == FORMAT_MP3 && appconfig.verbose >= 2)
+			lame_print_internals(appconfig.streams[0].writer->mp3lame->gfp);
 #endif
 
-	if (appconfig.verbose)
-		print_audio_info();
+	}
 
 	struct sigaction sigact = { .sa_handler = main_loop_stop };
 	sigaction(SIGTERM, &sigact, NULL);
 	sigaction(SIGINT, &sigact, NULL);
 
+	for (i = 0; i < appconfig.devices_count; i++) {
+		struct device *dev = &appconfig.devices[i];
 #if ENABLE_PORTAUDIO
-	if ((pa_err = Pa_StartStream(pa_stream)) != paNoError) {
-		error("Couldn't start PortAudio stream: %s", Pa_GetErrorText(pa_err));
+		if ((err = pthread_create(&dev->thread, NULL, &pa_capture_thread, dev)) != 0) {
+			error("Couldn't create PortAudio capture thread: %s", strerror(err));
+			return EXIT_FAILURE;
+		}
+		if ((pa_err = Pa_StartStream(dev->pa_stream)) != paNoError) {
+			error("Couldn't start PortAudio stream: %s", Pa_GetErrorText(pa_err));
+			return EXIT_FAILURE;
+		}
+#else
+		if ((err = pthread_create(&dev->thread, NULL, &alsa_capture_thread, dev)) != 0) {
+			error("Couldn't create ALSA capture thread: %s", strerror(err));
+			return EXIT_FAILURE;
+		}
+#endif
+	}
+
+	/* initialize output I/O stage: at least 64 blocks of 64 KiB */
+	const size_t output_blocks = appconfig.streams_count * 4 > 64 ?
+		appconfig.streams_count * 4 : 64;
+	if (!appconfig.signal_meter &&
+			(appconfig.oq = output_queue_init(output_blocks, 64 * 1024)) == NULL) {
+		error("Couldn't create output I/O thread: %s", strerror(errno));
 		return EXIT_FAILURE;
 	}
-#else
-	if ((err = pthread_create(&thread_alsa_capture_id, NULL, &alsa_capture_thread, pcm)) != 0) {
-		error("Couldn't create ALSA capture thread: %s", strerror(-err));
+
+	if (appconfig.verbose && appconfig.oq != NULL) {
+		info("Output I/O back-end: %s", output_queue_backend(appconfig.oq));
+		info("Encoder threads: %u", workers);
+	}
+
+	if (appconfig.split_time && workers > 0 &&
+			(err = pthread_create(&thread_finalizer_id, NULL, &finalizer_thread, NULL)) != 0) {
+		error("Couldn't create finalizer thread: %s", strerror(err));
 		return EXIT_FAILURE;
 	}
-#endif
 
-	/* initialize thread for data processing */
-	if ((err = pthread_create(&thread_process_id, NULL, &processing_thread, NULL)) != 0) {
-		error("Couldn't create processing thread: %s", strerror(-err));
+	/* initialize threads for data processing */
+	if (workers > 0 &&
+			(threads_process_id = malloc(sizeof(*threads_process_id) * workers)) == NULL) {
+		error("Couldn't create processing threads: %s", strerror(ENOMEM));
 		return EXIT_FAILURE;
 	}
+	for (i = 0; i < workers; i++)
+		if ((err = pthread_create(&threads_process_id[i], NULL,
+						&processing_thread, (void *)(uintptr_t)i)) != 0) {
+			error("Couldn't create processing thread: %s", strerror(err));
+			return EXIT_FAILURE;
+		}
 
 #if ENABLE_PORTAUDIO
-	while ((pa_err = Pa_IsStreamActive(pa_stream)) == 1)
-		Pa_Sleep(1000);
-	if (pa_err < 0) {
-		error("Couldn't check PortAudio activity: %s", Pa_GetErrorText(pa_err));
-		return EXIT_FAILURE;
+	for (i = 0; i < appconfig.devices_count; i++) {
+		while ((pa_err = Pa_IsStreamActive(appconfig.devices[i].pa_stream)) == 1)
+			Pa_Sleep(1000);
+		if (pa_err < 0) {
+			error("Couldn't check PortAudio activity: %s", Pa_GetErrorText(pa_err));
+			return EXIT_FAILURE;
+		}
 	}
-#else
-	pthread_join(thread_alsa_capture_id, NULL);
+	main_loop_on = false;
 #endif
+	for (i = 0; i < appconfig.devices_count; i++)
+		pthread_join(appconfig.devices[i].thread, NULL);
+
+	if (appconfig.noise_margin >= 0 && appconfig.noise_file != NULL)
+		noise_floor_save(appconfig.noise_file);
+
+	/* Let processing threads encode everything which is still queued in
+	 * the reader buffers, overflow memory and spill files. */
+	atomic_store(&appconfig.draining, true);
+	processing_notify(true);
+	for (i = 0; i < workers; i++)
+		pthread_join(threads_process_id[i], NULL);
+	free(threads_process_id);
+
+	if (appconfig.split_time && workers > 0) {
+		pthread_mutex_lock(&appconfig.finalizer.mutex);
+		appconfig.finalizer.running = false;
+		pthread_cond_broadcast(&appconfig.finalizer.cond);
+		pthread_mutex_unlock(&appconfig.finalizer.mutex);
+		pthread_join(thread_finalizer_id, NULL);
+	}
 
-	/* avoid dead-lock on the condition wait */
-	pthread_cond_signal(&appconfig.ready);
-	pthread_join(thread_process_id, NULL);
+	for (i = 0; i < appconfig.streams_count; i++) {
+		if (appconfig.streams[i].writer != NULL)
+			writer_free(appconfig.streams[i].writer);
+		if (appconfig.streams[i].spare != NULL)
+			writer_free(appconfig.streams[i].spare);
+	}
+
+	/* wait for all pending output operations */
+	if (appconfig.oq != NULL)
+		output_queue_free(appconfig.oq);
+
+	for (i = 0; i < appconfig.streams_count; i++) {
+		struct elastic *overflow = &appconfig.streams[i].overflow;
+		if (appconfig.verbose && (overflow->spilled > 0 || overflow->dropped > 0))
+			info("Overflow queue [%u:%u]: %" PRIu64 " bytes spilled, %" PRIu64 " bytes dropped",
+					appconfig.streams[i].device->index, appconfig.streams[i].index,
+					overflow->spilled, overflow->dropped);
+		elastic_free(overflow);
+	}
 
 	if (appconfig.signal_meter)
 		printf("\n");
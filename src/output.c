@@ -0,0 +1,446 @@
+/*
+ * SVAR - output.c
+ * SPDX-FileCopyrightText: 2025 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "output.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "debug.h"
+
+/* Get a free block from the pool. If there is no free block, wait until
+ * the I/O thread will release one - this is the back-pressure point. */
+static struct output_block *output_block_get(struct output_queue *q) {
+
+	struct output_block *b;
+
+	pthread_mutex_lock(&q->mutex);
+	while ((b = q->free) == NULL)
+		pthread_cond_wait(&q->cond_release, &q->mutex);
+	q->free = b->next;
+	pthread_mutex_unlock(&q->mutex);
+
+	b->next = NULL;
+	b->len = 0;
+	return b;
+}
+
+/* Return the block to the pool. */
+static void output_block_put(struct output_queue *q, struct output_block *b) {
+	pthread_mutex_lock(&q->mutex);
+	b->next = q->free;
+	q->free = b;
+	pthread_cond_signal(&q->cond_release);
+	pthread_mutex_unlock(&q->mutex);
+}
+
+/* Queue the request for the I/O thread. */
+static void output_block_submit(struct output_queue *q, struct output_block *b) {
+	pthread_mutex_lock(&q->mutex);
+	if (q->tail != NULL)
+		q->tail->next = b;
+	else
+		q->head = b;
+	q->tail = b;
+	pthread_cond_signal(&q->cond_request);
+	pthread_mutex_unlock(&q->mutex);
+}
+
+#if ENABLE_LIBURING
+
+static void output_uring_submit(struct output_queue *q, struct output_block *b);
+
+/* Handle io_uring write completion. */
+static void output_uring_complete(struct output_queue *q, struct io_uring_cqe *cqe) {
+
+	struct output_block *b = io_uring_cqe_get_data(cqe);
+	struct output *o = b->out;
+	const int res = cqe->res;
+
+	io_uring_cqe_seen(&q->ring, cqe);
+	q->inflight--;
+	o->inflight--;
+
+	/* zero-length write would never complete the block */
+	if (res < 0 || (res == 0 && b->done < b->len)) {
+		if (!output_failed(o))
+			error("Couldn't write output file: %s: %s", o->pathname,
+					strerror(res < 0 ? -res : EIO));
+		atomic_store(&o->failed, true);
+	}
+	else if ((b->done += res) < b->len) {
+		/* resubmit the remaining part of a short write */
+		output_uring_submit(q, b);
+		return;
+	}
+
+	output_block_put(q, b);
+}
+
+/* Reap io_uring completions, optionally waiting for at least one. */
+static void output_uring_reap(struct output_queue *q, bool wait) {
+	struct io_uring_cqe *cqe;
+	if (wait && io_uring_wait_cqe(&q->ring, &cqe) == 0)
+		output_uring_complete(q, cqe);
+	while (io_uring_peek_cqe(&q->ring, &cqe) == 0)
+		output_uring_complete(q, cqe);
+}
+
+/* Submit asynchronous write. The block will be released on completion. */
+static void output_uring_submit(struct output_queue *q, struct output_block *b) {
+
+	struct output *o = b->out;
+	struct io_uring_sqe *sqe;
+
+	/* keep the number of writes in flight within the ring size */
+	while (q->inflight == q->depth)
+		output_uring_reap(q, true);
+
+	sqe = io_uring_get_sqe(&q->ring);
+	if (q->uring_fixed)
+		io_uring_prep_write_fixed(sqe, o->fd, b->data + b->done, b->len - b->done,
+				b->offset + b->done, 0);
+	else
+		io_uring_prep_write(sqe, o->fd, b->data + b->done, b->len - b->done,
+				b->offset + b->done);
+	io_uring_sqe_set_data(sqe, b);
+	io_uring_submit(&q->ring);
+
+	q->inflight++;
+	o->inflight++;
+
+}
+
+/* Wait for completion of all writes in flight for the given output. */
+static void output_uring_drain(struct output_queue *q, struct output *o) {
+	while (o->inflight > 0)
+		output_uring_reap(q, true);
+}
+
+#endif
+
+/* Execute single I/O request. The block is returned to the pool when the
+ * request is completed. */
+static void output_block_process(struct output_queue *q, struct output_block *b) {
+
+	struct output *o = b->out;
+	ssize_t ret;
+	size_t len;
+
+	switch (b->op) {
+	case OUTPUT_OP_OPEN:
+		if ((o->fd = open(o->pathname, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1) {
+			error("Couldn't create output file: %s: %s", o->pathname, strerror(errno));
+			atomic_store(&o->failed, true);
+		}
+		break;
+	case OUTPUT_OP_WRITE:
+		if (o->fd == -1 || output_failed(o))
+			break;
+#if ENABLE_LIBURING
+		if (q->uring) {
+			/* Writes in flight might complete in any order, so overwriting
+			 * already submitted data (e.g. file header update) has to wait
+			 * for their completion. */
+			if (b->offset < o->submitted)
+				output_uring_drain(q, o);
+			if (o->submitted < b->offset + (off_t)b->len)
+				o->submitted = b->offset + b->len;
+			b->done = 0;
+			output_uring_submit(q, b);
+			return;
+		}
+#endif
+		for (len = 0; len < b->len; len += ret)
+			if ((ret = pwrite(o->fd, b->data + len, b->len - len, b->offset + len)) == -1) {
+				if (errno == EINTR) {
+					ret = 0;
+					continue;
+				}
+				if (!output_failed(o))
+					error("Couldn't write output file: %s: %s", o->pathname, strerror(errno));
+				atomic_store(&o->failed, true);
+				break;
+			}
+		break;
+	case OUTPUT_OP_CLOSE:
+#if ENABLE_LIBURING
+		if (q->uring)
+			output_uring_drain(q, o);
+#endif
+		if (o->fd != -1)
+			close(o->fd);
+		free(o->pathname);
+		free(o);
+		break;
+	}
+
+	output_block_put(q, b);
+}
+
+/* Output I/O thread. */
+static void *output_queue_thread(void *arg) {
+
+	struct output_queue *q = arg;
+	struct output_block *b;
+
+	for (;;) {
+
+		bool busy = false;
+#if ENABLE_LIBURING
+		/* do not sleep on the condition if there are writes in flight */
+		busy = q->inflight > 0;
+#endif
+
+		pthread_mutex_lock(&q->mutex);
+		while (q->head == NULL && q->running && !busy)
+			pthread_cond_wait(&q->cond_request, &q->mutex);
+		if ((b = q->head) != NULL && (q->head = b->next) == NULL)
+			q->tail = NULL;
+		pthread_mutex_unlock(&q->mutex);
+
+		if (b == NULL) {
+#if ENABLE_LIBURING
+			if (busy) {
+				output_uring_reap(q, true);
+				continue;
+			}
+#endif
+			/* all pending requests have been processed */
+			break;
+		}
+
+		output_block_process(q, b);
+#if ENABLE_LIBURING
+		if (q->uring)
+			output_uring_reap(q, false);
+#endif
+
+	}
+
+	return NULL;
+}
+
+struct output_queue *output_queue_init(size_t blocks, size_t block_size) {
+
+	struct output_queue *q;
+	size_t i;
+	int err;
+
+	if ((q = calloc(1, sizeof(*q))) == NULL ||
+			(q->blocks = calloc(blocks, sizeof(*q->blocks))) == NULL ||
+			(q->pool = malloc(blocks * block_size)) == NULL) {
+		errno = ENOMEM;
+		goto fail;
+	}
+
+	pthread_mutex_init(&q->mutex, NULL);
+	pthread_cond_init(&q->cond_request, NULL);
+	pthread_cond_init(&q->cond_release, NULL);
+	q->block_size = block_size;
+	q->running = true;
+
+	for (i = 0; i < blocks; i++) {
+		q->blocks[i].data = q->pool + i * block_size;
+		q->blocks[i].next = q->free;
+		q->free = &q->blocks[i];
+	}
+
+#if ENABLE_LIBURING
+	/* use io_uring if it is supported by the kernel, otherwise fall back to
+	 * the synchronous I/O in the output thread */
+	q->depth = blocks < 16 ? blocks : 16;
+	if ((err = io_uring_queue_init(q->depth, &q->ring, 0)) == 0) {
+		struct iovec iov = { .iov_base = q->pool, .iov_len = blocks * block_size };
+		q->uring_fixed = io_uring_register_buffers(&q->ring, &iov, 1) == 0;
+		q->uring = true;
+	}
+	else
+		debug("Couldn't initialize io_uring: %s", strerror(-err));
+#endif
+
+	if ((err = pthread_create(&q->thread, NULL, output_queue_thread, q)) != 0) {
+#if ENABLE_LIBURING
+		if (q->uring)
+			io_uring_queue_exit(&q->ring);
+#endif
+		errno = err;
+		goto fail;
+	}
+
+	return q;
+
+fail:
+	if (q != NULL) {
+		free(q->blocks);
+		free(q->pool);
+	}
+	free(q);
+	return NULL;
+}
+
+/* Terminate the I/O thread, after all pending requests are processed. */
+void output_queue_free(struct output_queue *q) {
+
+	pthread_mutex_lock(&q->mutex);
+	q->running = false;
+	pthread_cond_signal(&q->cond_request);
+	pthread_mutex_unlock(&q->mutex);
+
+	pthread_join(q->thread, NULL);
+#if ENABLE_LIBURING
+	if (q->uring)
+		io_uring_queue_exit(&q->ring);
+#endif
+	pthread_cond_destroy(&q->cond_release);
+	pthread_cond_destroy(&q->cond_request);
+	pthread_mutex_destroy(&q->mutex);
+
+	free(q->blocks);
+	free(q->pool);
+	free(q);
+
+}
+
+/* Get the name of the I/O back-end. */
+const char *output_queue_backend(struct output_queue *q) {
+#if ENABLE_LIBURING
+	if (q->uring)
+		return q->uring_fixed ? "io_uring (registered buffers)" : "io_uring";
+#else
+	(void)q;
+#endif
+	return "pwrite";
+}
+
+/* Create new output file.
+ *
+ * The file is created asynchronously by the I/O thread, so this function
+ * does not report I/O errors. Use output_failed() to check whether all
+ * previous operations have succeeded. */
+struct output *output_open(struct output_queue *q, const char *pathname) {
+
+	struct output_block *b;
+	struct output *o;
+
+	if ((o = calloc(1, sizeof(*o))) == NULL ||
+			(o->pathname = strdup(pathname)) == NULL) {
+		free(o);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	o->q = q;
+	o->fd = -1;
+	atomic_init(&o->failed, false);
+
+	b = output_block_get(q);
+	b->op = OUTPUT_OP_OPEN;
+	b->out = o;
+	output_block_submit(q, b);
+
+	return o;
+}
+
+/* Close the output file.
+ *
+ * All buffered data are submitted to the I/O thread, which will also release
+ * resources associated with the output. The output must not be used after
+ * this call. */
+void output_close(struct output *o) {
+
+	struct output_block *b;
+
+	output_flush(o);
+
+	b = output_block_get(o->q);
+	b->op = OUTPUT_OP_CLOSE;
+	b->out = o;
+	output_block_submit(o->q, b);
+
+}
+
+/* Write data at the current position. */
+ssize_t output_write(struct output *o, const void *buffer, size_t len) {
+
+	const unsigned char *data = buffer;
+	const size_t total = len;
+	size_t n;
+
+	if (output_failed(o)) {
+		errno = EIO;
+		return -1;
+	}
+
+	while (len > 0) {
+
+		if (o->block == NULL) {
+			o->block = output_block_get(o->q);
+			o->block->op = OUTPUT_OP_WRITE;
+			o->block->out = o;
+			o->block->offset = o->position;
+		}
+
+		if ((n = o->q->block_size - o->block->len) > len)
+			n = len;
+
+		memcpy(o->block->data + o->block->len, data, n);
+		o->block->len += n;
+		o->position += n;
+		data += n;
+		len -= n;
+
+		if (o->block->len == o->q->block_size)
+			output_flush(o);
+
+	}
+
+	if (o->length < o->position)
+		o->length = o->position;
+
+	return total;
+}
+
+/* Change the current write position. */
+off_t output_seek(struct output *o, off_t offset, int whence) {
+
+	switch (whence) {
+	case SEEK_SET:
+		break;
+	case SEEK_CUR:
+		offset += o->position;
+		break;
+	case SEEK_END:
+		offset += o->length;
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (offset < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* buffered data have to be written at their original position */
+	output_flush(o);
+
+	return o->position = offset;
+}
+
+/* Submit buffered data to the I/O thread. */
+void output_flush(struct output *o) {
+	if (o->block == NULL)
+		return;
+	output_block_submit(o->q, o->block);
+	o->block = NULL;
+}
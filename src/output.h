@@ -0,0 +1,110 @@
+/*
+ * SVAR - output.h
+ * SPDX-FileCopyrightText: 2025 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef SVAR_OUTPUT_H_
+#define SVAR_OUTPUT_H_
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#if ENABLE_LIBURING
+# include <liburing.h>
+#endif
+
+enum output_op {
+	OUTPUT_OP_OPEN,
+	OUTPUT_OP_WRITE,
+	OUTPUT_OP_CLOSE,
+};
+
+struct output_block {
+	struct output_block *next;
+	struct output *out;
+	enum output_op op;
+	/* file offset of the data */
+	off_t offset;
+	size_t len;
+	/* number of bytes already written */
+	size_t done;
+	unsigned char *data;
+};
+
+/* Output I/O stage - bounded queue of requests served by the I/O thread. */
+struct output_queue {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_request;
+	pthread_cond_t cond_release;
+	/* pending requests */
+	struct output_block *head;
+	struct output_block *tail;
+	/* free blocks */
+	struct output_block *free;
+	struct output_block *blocks;
+	unsigned char *pool;
+	size_t block_size;
+	bool running;
+#if ENABLE_LIBURING
+	struct io_uring ring;
+	bool uring;
+	bool uring_fixed;
+	/* number of writes in flight */
+	unsigned int inflight;
+	unsigned int depth;
+#endif
+};
+
+/* Output file with asynchronous I/O. */
+struct output {
+	struct output_queue *q;
+	char *pathname;
+	/* file descriptor (owned by the I/O thread) */
+	int fd;
+	atomic_bool failed;
+	/* currently filled block */
+	struct output_block *block;
+	/* current write position and file length */
+	off_t position;
+	off_t length;
+#if ENABLE_LIBURING
+	/* number of writes in flight */
+	unsigned int inflight;
+	/* end of the submitted data */
+	off_t submitted;
+#endif
+};
+
+struct output_queue *output_queue_init(size_t blocks, size_t block_size);
+void output_queue_free(struct output_queue *q);
+const char *output_queue_backend(struct output_queue *q);
+
+struct output *output_open(struct output_queue *q, const char *pathname);
+void output_close(struct output *o);
+
+ssize_t output_write(struct output *o, const void *buffer, size_t len);
+off_t output_seek(struct output *o, off_t offset, int whence);
+void output_flush(struct output *o);
+
+static inline off_t output_tell(struct output *o) {
+	return o->position;
+}
+
+static inline off_t output_length(struct output *o) {
+	return o->length;
+}
+
+static inline bool output_failed(struct output *o) {
+	return atomic_load_explicit(&o->failed, memory_order_relaxed);
+}
+
+#endif
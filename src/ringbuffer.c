@@ -0,0 +1,99 @@
+/*
+ * SVAR - ringbuffer.c
+ * SPDX-FileCopyrightText: 2025 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "ringbuffer.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+int ringbuffer_init(struct ringbuffer *rb, size_t frames, size_t frame_size) {
+
+	size_t size = 1;
+	while (size < frames)
+		size <<= 1;
+
+	if ((rb->data = malloc(size * frame_size)) == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	rb->frame_size = frame_size;
+	rb->size = size;
+	atomic_init(&rb->head, 0);
+	atomic_init(&rb->tail, 0);
+
+	return 0;
+}
+
+void ringbuffer_free(struct ringbuffer *rb) {
+	free(rb->data);
+	rb->data = NULL;
+}
+
+/* Get the number of frames available for reading. */
+size_t ringbuffer_available(struct ringbuffer *rb) {
+	return atomic_load_explicit(&rb->head, memory_order_acquire) -
+		atomic_load_explicit(&rb->tail, memory_order_relaxed);
+}
+
+/* Get the number of frames which can be written without overrun. */
+size_t ringbuffer_space(struct ringbuffer *rb) {
+	return rb->size - (atomic_load_explicit(&rb->head, memory_order_relaxed) -
+			atomic_load_explicit(&rb->tail, memory_order_acquire));
+}
+
+/* Write frames into the ring buffer (producer side).
+ *
+ * This function never blocks. If there is not enough space in the buffer,
+ * only the leading part of the data is written. It returns the number of
+ * frames actually written. */
+size_t ringbuffer_write(struct ringbuffer *rb, const void *buffer, size_t frames) {
+
+	const size_t head = atomic_load_explicit(&rb->head, memory_order_relaxed);
+	const size_t tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
+	const size_t offset = head & (rb->size - 1);
+	size_t len;
+
+	if (frames > rb->size - (head - tail))
+		frames = rb->size - (head - tail);
+
+	/* copy data up to the end of the buffer and wrap around if needed */
+	if ((len = rb->size - offset) > frames)
+		len = frames;
+	memcpy(rb->data + offset * rb->frame_size, buffer, len * rb->frame_size);
+	memcpy(rb->data, (const unsigned char *)buffer + len * rb->frame_size,
+			(frames - len) * rb->frame_size);
+
+	atomic_store_explicit(&rb->head, head + frames, memory_order_release);
+	return frames;
+}
+
+/* Get the pointer to the readable data (consumer side).
+ *
+ * This function returns the number of frames which can be read in place
+ * from the returned buffer. Data which wraps around the end of the ring
+ * buffer will be returned by the subsequent call, after the consumption
+ * of the current block. */
+size_t ringbuffer_peek(struct ringbuffer *rb, void **buffer) {
+
+	const size_t tail = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+	const size_t head = atomic_load_explicit(&rb->head, memory_order_acquire);
+	const size_t offset = tail & (rb->size - 1);
+	size_t frames = head - tail;
+
+	if (frames > rb->size - offset)
+		frames = rb->size - offset;
+
+	*buffer = rb->data + offset * rb->frame_size;
+	return frames;
+}
+
+/* Release frames obtained by the ringbuffer_peek() call. */
+void ringbuffer_consume(struct ringbuffer *rb, size_t frames) {
+	const size_t tail = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+	atomic_store_explicit(&rb->tail, tail + frames, memory_order_release);
+}
@@ -0,0 +1,36 @@
+/*
+ * SVAR - ringbuffer.h
+ * SPDX-FileCopyrightText: 2025 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef SVAR_RINGBUFFER_H_
+#define SVAR_RINGBUFFER_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/* Lock-free single-producer single-consumer ring buffer of frames. */
+struct ringbuffer {
+	unsigned char *data;
+	/* size of a single frame in bytes */
+	size_t frame_size;
+	/* capacity in frames (power of two) */
+	size_t size;
+	/* free-running write and read positions (in frames) */
+	atomic_size_t head;
+	atomic_size_t tail;
+};
+
+int ringbuffer_init(struct ringbuffer *rb, size_t frames, size_t frame_size);
+void ringbuffer_free(struct ringbuffer *rb);
+
+size_t ringbuffer_available(struct ringbuffer *rb);
+size_t ringbuffer_space(struct ringbuffer *rb);
+
+size_t ringbuffer_write(struct ringbuffer *rb, const void *buffer, size_t frames);
+
+size_t ringbuffer_peek(struct ringbuffer *rb, void **buffer);
+void ringbuffer_consume(struct ringbuffer *rb, size_t frames);
+
+#endif
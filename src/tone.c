@@ -0,0 +1,116 @@
+/*
+ * SVAR - tone.c
+ * SPDX-FileCopyrightText: 2025 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "tone.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Initialize tone detector bank.
+ *
+ * Tones are analyzed in blocks of 20 ms, so the bandwidth of every filter
+ * is about 50 Hz. Thresholds are given in % of max signal, and they are
+ * compared with the amplitude of the tone. */
+int tone_init(struct tone *t, unsigned int channels, unsigned int rate,
+		const unsigned int *frequencies, const int *thresholds, unsigned int count) {
+
+	unsigned int i;
+
+	memset(t, 0, sizeof(*t));
+	t->channels = channels;
+	t->count = count;
+	t->size = rate / 50;
+
+	if ((t->coeff = malloc(sizeof(*t->coeff) * count)) == NULL ||
+			(t->threshold = malloc(sizeof(*t->threshold) * count)) == NULL ||
+			(t->s1 = calloc(channels * count, sizeof(*t->s1))) == NULL ||
+			(t->s2 = calloc(channels * count, sizeof(*t->s2))) == NULL ||
+			(t->active = calloc(channels, sizeof(*t->active))) == NULL) {
+		tone_free(t);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		t->coeff[i] = 2 * cosf(2 * M_PI * frequencies[i] / rate);
+		t->threshold[i] = (float)thresholds[i] * 0x7fff / 100;
+	}
+
+	return 0;
+}
+
+void tone_free(struct tone *t) {
+	free(t->coeff);
+	free(t->threshold);
+	free(t->s1);
+	free(t->s2);
+	free(t->active);
+}
+
+/* Check tone amplitudes at the end of the analysis block. */
+static void tone_evaluate(struct tone *t) {
+
+	const unsigned int count = t->count;
+	const float scale = 2.0f / t->size;
+	unsigned int c, i;
+
+	for (c = 0; c < t->channels; c++) {
+
+		float *s1 = &t->s1[c * count];
+		float *s2 = &t->s2[c * count];
+		bool active = false;
+
+		for (i = 0; i < count; i++) {
+			const float power = s1[i] * s1[i] + s2[i] * s2[i] - t->coeff[i] * s1[i] * s2[i];
+			if (scale * sqrtf(power > 0 ? power : 0) > t->threshold[i])
+				active = true;
+			s1[i] = s2[i] = 0;
+		}
+
+		t->active[c] = active;
+
+	}
+
+}
+
+/* Update tone detectors with the next frames.
+ *
+ * The state of all filters of a channel is stored contiguously, so the
+ * inner loop over tones is vectorized by the compiler. Channel activity is
+ * updated at the end of every analysis block. */
+void tone_update_S16_LE(struct tone *t, const int16_t *buffer, size_t frames) {
+
+	const unsigned int channels = t->channels;
+	const unsigned int count = t->count;
+	const float * restrict coeff = t->coeff;
+	size_t n;
+
+	for (n = 0; n < frames; n++, buffer += channels) {
+
+		for (unsigned int c = 0; c < channels; c++) {
+
+			float * restrict s1 = &t->s1[c * count];
+			float * restrict s2 = &t->s2[c * count];
+			const float x = buffer[c];
+
+			for (unsigned int i = 0; i < count; i++) {
+				const float s0 = x + coeff[i] * s1[i] - s2[i];
+				s2[i] = s1[i];
+				s1[i] = s0;
+			}
+
+		}
+
+		if (++t->fill == t->size) {
+			tone_evaluate(t);
+			t->fill = 0;
+		}
+
+	}
+
+}
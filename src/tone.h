@@ -0,0 +1,36 @@
+/*
+ * SVAR - tone.h
+ * SPDX-FileCopyrightText: 2025 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef SVAR_TONE_H_
+#define SVAR_TONE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Per-channel bank of Goertzel tone detectors. */
+struct tone {
+	unsigned int channels;
+	/* number of tones in the bank */
+	unsigned int count;
+	/* analysis block size (in frames) */
+	size_t size;
+	size_t fill;
+	/* per-tone Goertzel coefficients and thresholds (in sample units) */
+	float *coeff;
+	float *threshold;
+	/* per-channel filter state (channels * count) */
+	float *s1, *s2;
+	bool *active;
+};
+
+int tone_init(struct tone *t, unsigned int channels, unsigned int rate,
+		const unsigned int *frequencies, const int *thresholds, unsigned int count);
+void tone_free(struct tone *t);
+
+void tone_update_S16_LE(struct tone *t, const int16_t *buffer, size_t frames);
+
+#endif
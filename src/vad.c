@@ -0,0 +1,241 @@
+/*
+ * SVAR - vad.c
+ * SPDX-FileCopyrightText: 2025 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "vad.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Speech band limits (in Hz). */
+#define VAD_BAND_LO 300
+#define VAD_BAND_HI 3400
+/* Minimal fraction of the signal energy in the speech band. */
+#define VAD_BAND_RATIO 0.5f
+/* Allowed zero-crossing rate (in crossings per second). */
+#define VAD_ZCR_MIN 200
+#define VAD_ZCR_MAX 5000
+/* Smoothing factor of the per-frame speech decisions. */
+#define VAD_SMOOTHING 0.3f
+
+/* Initialize voice activity detector.
+ *
+ * The analysis frame is about 20 ms long (rounded up to the power of 2),
+ * which is short enough for the speech to be quasi-stationary. */
+int vad_init(struct vad *v, unsigned int channels, unsigned int rate) {
+
+	size_t size = 128;
+	size_t i, len, n;
+
+	while (size < rate / 50 && size < 4096)
+		size *= 2;
+
+	memset(v, 0, sizeof(*v));
+	v->channels = channels;
+	v->rate = rate;
+	v->size = size;
+
+	const size_t m = size / 2;
+	v->band_lo = (VAD_BAND_LO * size + rate - 1) / rate;
+	v->band_hi = VAD_BAND_HI * size / rate;
+	if (v->band_hi > m)
+		v->band_hi = m;
+
+	if ((v->window = malloc(sizeof(*v->window) * size)) == NULL ||
+			(v->tw_re = malloc(sizeof(*v->tw_re) * m)) == NULL ||
+			(v->tw_im = malloc(sizeof(*v->tw_im) * m)) == NULL ||
+			(v->rt_re = malloc(sizeof(*v->rt_re) * m)) == NULL ||
+			(v->rt_im = malloc(sizeof(*v->rt_im) * m)) == NULL ||
+			(v->bitrev = malloc(sizeof(*v->bitrev) * m)) == NULL ||
+			(v->re = malloc(sizeof(*v->re) * m)) == NULL ||
+			(v->im = malloc(sizeof(*v->im) * m)) == NULL ||
+			(v->samples = malloc(sizeof(*v->samples) * size * channels)) == NULL ||
+			(v->fill = calloc(channels, sizeof(*v->fill))) == NULL ||
+			(v->score = calloc(channels, sizeof(*v->score))) == NULL ||
+			(v->speech = calloc(channels, sizeof(*v->speech))) == NULL) {
+		vad_free(v);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	for (i = 0; i < size; i++)
+		v->window[i] = 0.5f - 0.5f * cosf(2 * M_PI * i / size);
+
+	/* Twiddle factors of all stages are stored one after another, so the
+	 * butterfly loop of every stage reads them sequentially. */
+	for (len = 1, n = 0; len < m; len *= 2)
+		for (i = 0; i < len; i++, n++) {
+			v->tw_re[n] = cosf(M_PI * i / len);
+			v->tw_im[n] = -sinf(M_PI * i / len);
+		}
+
+	/* twiddle factors for splitting the complex FFT into the real one */
+	for (i = 0; i < m; i++) {
+		v->rt_re[i] = cosf(2 * M_PI * i / size);
+		v->rt_im[i] = -sinf(2 * M_PI * i / size);
+	}
+
+	for (i = 0; i < m; i++) {
+		unsigned int r = 0;
+		for (len = 1; len < m; len *= 2)
+			r = (r << 1) | ((i / len) & 1);
+		v->bitrev[i] = r;
+	}
+
+	return 0;
+}
+
+void vad_free(struct vad *v) {
+	free(v->window);
+	free(v->tw_re);
+	free(v->tw_im);
+	free(v->rt_re);
+	free(v->rt_im);
+	free(v->bitrev);
+	free(v->re);
+	free(v->im);
+	free(v->samples);
+	free(v->fill);
+	free(v->score);
+	free(v->speech);
+}
+
+/* In-place radix-2 complex FFT of the bit-reversed input.
+ *
+ * Real and imaginary parts are kept in separate arrays, so the inner loop
+ * of every stage can be vectorized by the compiler. */
+static void vad_fft(struct vad *v) {
+
+	const size_t m = v->size / 2;
+	float * restrict re = v->re;
+	float * restrict im = v->im;
+	size_t len, i, j, n;
+
+	for (len = 1, n = 0; len < m; n += len, len *= 2) {
+		const float * restrict wr = &v->tw_re[n];
+		const float * restrict wi = &v->tw_im[n];
+		for (i = 0; i < m; i += 2 * len) {
+			float * restrict ar = &re[i];
+			float * restrict ai = &im[i];
+			float * restrict br = &re[i + len];
+			float * restrict bi = &im[i + len];
+			for (j = 0; j < len; j++) {
+				const float tr = br[j] * wr[j] - bi[j] * wi[j];
+				const float ti = br[j] * wi[j] + bi[j] * wr[j];
+				br[j] = ar[j] - tr;
+				bi[j] = ai[j] - ti;
+				ar[j] += tr;
+				ai[j] += ti;
+			}
+		}
+	}
+
+}
+
+/* Classify single analysis frame of a given channel. */
+static bool vad_analyze(struct vad *v, const float *x) {
+
+	const size_t size = v->size;
+	const size_t m = size / 2;
+	unsigned int crossings = 0;
+	float mean = 0;
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		mean += x[i];
+	mean /= size;
+
+	for (i = 1; i < size; i++)
+		crossings += (x[i - 1] < mean) != (x[i] < mean);
+
+	const unsigned int zcr = (uint64_t)crossings * v->rate / size;
+	if (zcr < VAD_ZCR_MIN || zcr > VAD_ZCR_MAX)
+		return false;
+
+	/* pack even and odd samples as a complex signal of half the length */
+	for (i = 0; i < m; i++) {
+		const unsigned int r = v->bitrev[i];
+		v->re[r] = (x[2 * i] - mean) * v->window[2 * i];
+		v->im[r] = (x[2 * i + 1] - mean) * v->window[2 * i + 1];
+	}
+
+	vad_fft(v);
+
+	/* DC bin is skipped, Nyquist bin is obtained from the first one */
+	const float nyquist = v->re[0] - v->im[0];
+	float total = nyquist * nyquist;
+	float band = v->band_hi == m ? total : 0;
+
+	for (i = 1; i < m; i++) {
+
+		const float zr = v->re[i], zi = v->im[i];
+		const float cr = v->re[m - i], ci = -v->im[m - i];
+
+		/* X[k] = (Z[k] + Z*[M-k]) / 2 + W[k] * (Z[k] - Z*[M-k]) / 2i */
+		const float er = (zr + cr) / 2, ei = (zi + ci) / 2;
+		const float odr = (zi - ci) / 2, odi = -(zr - cr) / 2;
+		const float xr = er + v->rt_re[i] * odr - v->rt_im[i] * odi;
+		const float xi = ei + v->rt_re[i] * odi + v->rt_im[i] * odr;
+		const float power = xr * xr + xi * xi;
+
+		total += power;
+		if (i >= v->band_lo && i <= v->band_hi)
+			band += power;
+
+	}
+
+	return total > 0 && band >= VAD_BAND_RATIO * total;
+}
+
+/* Update speech activity with the next frames.
+ *
+ * Channels for which the level detector is not active are not analyzed at
+ * all, so the VAD costs nothing when there is no signal. */
+void vad_update_S16_LE(struct vad *v, const int16_t *buffer, size_t frames,
+		const bool *active) {
+
+	const unsigned int channels = v->channels;
+	unsigned int c;
+
+	for (c = 0; c < channels; c++) {
+
+		if (!active[c]) {
+			v->fill[c] = 0;
+			v->score[c] = 0;
+			v->speech[c] = false;
+			continue;
+		}
+
+		float *samples = &v->samples[c * v->size];
+		size_t i = 0;
+
+		while (i < frames) {
+
+			size_t n = v->size - v->fill[c];
+			if (n > frames - i)
+				n = frames - i;
+
+			float *x = &samples[v->fill[c]];
+			const int16_t *ptr = &buffer[i * channels + c];
+			for (size_t j = 0; j < n; j++)
+				x[j] = ptr[j * channels];
+
+			v->fill[c] += n;
+			i += n;
+
+			if (v->fill[c] == v->size) {
+				const bool speech = vad_analyze(v, samples);
+				v->score[c] += VAD_SMOOTHING * ((float)speech - v->score[c]);
+				v->speech[c] = v->score[c] >= 0.5f;
+				v->fill[c] = 0;
+			}
+
+		}
+
+	}
+
+}
@@ -0,0 +1,48 @@
+/*
+ * SVAR - vad.h
+ * SPDX-FileCopyrightText: 2025 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef SVAR_VAD_H_
+#define SVAR_VAD_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Worst-case delay of the speech confirmation (in ms). The pre-roll
+ * history shall cover this time, so the beginning of the speech is not
+ * lost while the decision is pending. */
+#define VAD_DELAY_MS 200
+
+/* Per-channel spectral-band voice activity detector. */
+struct vad {
+	unsigned int channels;
+	unsigned int rate;
+	/* analysis frame size (power of 2) */
+	size_t size;
+	/* speech band (FFT bins) */
+	size_t band_lo;
+	size_t band_hi;
+	/* FFT tables */
+	float *window;
+	float *tw_re, *tw_im;
+	float *rt_re, *rt_im;
+	unsigned int *bitrev;
+	/* FFT work buffers */
+	float *re, *im;
+	/* per-channel state */
+	float *samples;
+	size_t *fill;
+	float *score;
+	bool *speech;
+};
+
+int vad_init(struct vad *v, unsigned int channels, unsigned int rate);
+void vad_free(struct vad *v);
+
+void vad_update_S16_LE(struct vad *v, const int16_t *buffer, size_t frames,
+		const bool *active);
+
+#endif
@@ -0,0 +1,166 @@
+/*
+ * SVAR - writer_flac.c
+ * SPDX-FileCopyrightText: 2025 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "writer_flac.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "debug.h"
+
+static FLAC__StreamEncoderWriteStatus flac_write(const FLAC__StreamEncoder *enc,
+		const FLAC__byte buffer[], size_t len, uint32_t samples, uint32_t frame,
+		void *user_data) {
+	(void)enc;
+	(void)samples;
+	(void)frame;
+	if (output_write(user_data, buffer, len) == -1)
+		return FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR;
+	return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+}
+
+/* Seeking is used at the end of the stream for updating the STREAMINFO
+ * block with the number of samples and the MD5 signature. */
+static FLAC__StreamEncoderSeekStatus flac_seek(const FLAC__StreamEncoder *enc,
+		FLAC__uint64 offset, void *user_data) {
+	(void)enc;
+	if (output_seek(user_data, offset, SEEK_SET) == -1)
+		return FLAC__STREAM_ENCODER_SEEK_STATUS_ERROR;
+	return FLAC__STREAM_ENCODER_SEEK_STATUS_OK;
+}
+
+static FLAC__StreamEncoderTellStatus flac_tell(const FLAC__StreamEncoder *enc,
+		FLAC__uint64 *offset, void *user_data) {
+	(void)enc;
+	*offset = output_tell(user_data);
+	return FLAC__STREAM_ENCODER_TELL_STATUS_OK;
+}
+
+struct writer_flac *writer_flac_init(int channels, int sampling, int level,
+		int block_size, const char *comment) {
+
+	FLAC__StreamMetadata_VorbisComment_Entry entry;
+	struct writer_flac *w;
+
+	if ((w = calloc(1, sizeof(*w))) == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	w->channels = channels;
+	w->sampling = sampling;
+	w->level = level;
+	w->block_size = block_size;
+
+	if ((w->enc = FLAC__stream_encoder_new()) == NULL ||
+			(w->tags = FLAC__metadata_object_new(FLAC__METADATA_TYPE_VORBIS_COMMENT)) == NULL ||
+			(w->pcm = malloc(sizeof(*w->pcm) * channels * WRITER_FLAC_CHUNK_FRAMES)) == NULL) {
+		errno = ENOMEM;
+		goto fail;
+	}
+
+	if (!FLAC__metadata_object_vorbiscomment_entry_from_name_value_pair(&entry,
+				"ENCODER", comment)) {
+		errno = ENOMEM;
+		goto fail;
+	}
+	/* on success, the metadata object takes ownership of the entry */
+	if (!FLAC__metadata_object_vorbiscomment_append_comment(w->tags, entry, false)) {
+		free(entry.entry);
+		errno = ENOMEM;
+		goto fail;
+	}
+
+	return w;
+
+fail:
+	writer_flac_free(w);
+	return NULL;
+}
+
+void writer_flac_free(struct writer_flac *w) {
+	writer_flac_close(w);
+	if (w->enc != NULL)
+		FLAC__stream_encoder_delete(w->enc);
+	if (w->tags != NULL)
+		FLAC__metadata_object_delete(w->tags);
+	free(w->pcm);
+	free(w);
+}
+
+/* Start new FLAC stream. The writer takes ownership of the output. */
+int writer_flac_open(struct writer_flac *w, struct output *out) {
+
+	FLAC__StreamEncoderInitStatus status;
+
+	writer_flac_close(w);
+	w->out = out;
+
+	/* Finishing the stream resets the encoder settings, so they have to be
+	 * applied before every initialization. Block sizes above 4608 frames
+	 * are not allowed in the streamable subset. */
+	if (!FLAC__stream_encoder_set_channels(w->enc, w->channels) ||
+			!FLAC__stream_encoder_set_bits_per_sample(w->enc, 16) ||
+			!FLAC__stream_encoder_set_sample_rate(w->enc, w->sampling) ||
+			!FLAC__stream_encoder_set_compression_level(w->enc, w->level) ||
+			(w->block_size > 0 &&
+			 !FLAC__stream_encoder_set_blocksize(w->enc, w->block_size)) ||
+			!FLAC__stream_encoder_set_streamable_subset(w->enc, w->block_size <= 4608) ||
+			!FLAC__stream_encoder_set_metadata(w->enc, &w->tags, 1)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((status = FLAC__stream_encoder_init_stream(w->enc, flac_write, flac_seek,
+					flac_tell, NULL, out)) != FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
+		error("FLAC: Couldn't initialize encoder: %s",
+				FLAC__StreamEncoderInitStatusString[status]);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+void writer_flac_close(struct writer_flac *w) {
+	if (w->out == NULL)
+		return;
+	/* encode buffered samples and update the STREAMINFO block */
+	if (!FLAC__stream_encoder_finish(w->enc))
+		error("FLAC: Couldn't finish stream: %s",
+				FLAC__StreamEncoderStateString[FLAC__stream_encoder_get_state(w->enc)]);
+	output_close(w->out);
+	w->out = NULL;
+}
+
+ssize_t writer_flac_write(struct writer_flac *w, int16_t *buffer, size_t frames) {
+
+	const off_t position = output_tell(w->out);
+	const int channels = w->channels;
+
+	while (frames > 0) {
+
+		const size_t chunk = frames < WRITER_FLAC_CHUNK_FRAMES ?
+			frames : WRITER_FLAC_CHUNK_FRAMES;
+
+		/* encoder accepts samples as 32-bit integers only */
+		for (size_t i = 0; i < chunk * channels; i++)
+			w->pcm[i] = buffer[i];
+
+		if (!FLAC__stream_encoder_process_interleaved(w->enc, w->pcm, chunk)) {
+			error("FLAC: Couldn't encode frames: %s",
+					FLAC__StreamEncoderStateString[FLAC__stream_encoder_get_state(w->enc)]);
+			return -1;
+		}
+
+		buffer += chunk * channels;
+		frames -= chunk;
+
+	}
+
+	return output_tell(w->out) - position;
+}
@@ -0,0 +1,42 @@
+/*
+ * SVAR - writer_flac.h
+ * SPDX-FileCopyrightText: 2025 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef SVAR_WRITER_FLAC_H_
+#define SVAR_WRITER_FLAC_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <FLAC/metadata.h>
+#include <FLAC/stream_encoder.h>
+
+#include "output.h"
+
+/* Number of frames passed to the encoder at once. */
+#define WRITER_FLAC_CHUNK_FRAMES 4096
+
+struct writer_flac {
+	FLAC__StreamEncoder *enc;
+	FLAC__StreamMetadata *tags;
+	int channels;
+	int sampling;
+	int level;
+	int block_size;
+	/* buffer for samples converted to 32-bit integers */
+	FLAC__int32 *pcm;
+	struct output *out;
+};
+
+struct writer_flac *writer_flac_init(int channels, int sampling, int level,
+		int block_size, const char *comment);
+void writer_flac_free(struct writer_flac *w);
+
+int writer_flac_open(struct writer_flac *w, struct output *out);
+void writer_flac_close(struct writer_flac *w);
+
+ssize_t writer_flac_write(struct writer_flac *w, int16_t *buffer, size_t frames);
+
+#endif
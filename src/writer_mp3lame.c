@@ -69,29 +69,89 @@ void writer_mp3lame_free(struct writer_mp3lame *w) {
 	free(w);
 }
 
-int writer_mp3lame_open(struct writer_mp3lame *w, const char *pathname) {
+/* Start new MP3 stream. The writer takes ownership of the output. */
+int writer_mp3lame_open(struct writer_mp3lame *w, struct output *out) {
 
 	writer_mp3lame_close(w);
-
-	if ((w->fp = fopen(pathname, "w")) == NULL)
-		return -1;
-
-	int len = lame_get_id3v2_tag(w->gfp, w->mp3buf, sizeof(w->mp3buf));
-	fwrite(w->mp3buf, 1, len, w->fp);
+	w->out = out;
+
+	/* Restart the bitstream of the already initialized encoder, so we will
+	 * not have to pay the setup cost and the psychoacoustic model will not
+	 * start from a cold state. */
+	if (w->nogap)
+		lame_init_bitstream(w->gfp);
+
+	/* If the tag does not fit into the buffer, its required size is
+	 * returned, but nothing is written. */
+	size_t len = lame_get_id3v2_tag(w->gfp, w->mp3buf, sizeof(w->mp3buf));
+	if (len > sizeof(w->mp3buf))
+		warn("LAME: ID3v2 tag too large: %zu", len);
+	else
+		output_write(w->out, w->mp3buf, len);
 
 	return 0;
 }
 
 void writer_mp3lame_close(struct writer_mp3lame *w) {
-	if (w->fp == NULL)
+
+	/* zero samples for pushing out the encoder buffer */
+	static short int silence[2 * WRITER_MP3LAME_CHUNK_FRAMES];
+	int len;
+
+	if (w->out == NULL)
 		return;
-	int len = lame_encode_flush(w->gfp, w->mp3buf, sizeof(w->mp3buf));
-	fwrite(w->mp3buf, 1, len, w->fp);
-	fclose(w->fp);
-	w->fp = NULL;
+
+	/* The encoder keeps the encoder delay and a partial frame buffered, and
+	 * the no-gap flush does not output them. Writers are swapped on every
+	 * split, so this writer will not encode the next file of the recording.
+	 * Push the buffered samples out with silence, so only the silence is
+	 * carried over to the stream opened by this writer next time. */
+	size_t frames = lame_get_encoder_delay(w->gfp) + lame_get_framesize(w->gfp);
+	if (frames > WRITER_MP3LAME_CHUNK_FRAMES)
+		frames = WRITER_MP3LAME_CHUNK_FRAMES;
+	if ((len = lame_encode(w->gfp, silence, frames, w->mp3buf, sizeof(w->mp3buf))) < 0)
+		error("LAME: Couldn't encode frames: %d", len);
+	else
+		output_write(w->out, w->mp3buf, len);
+
+	/* complete the last MP3 frame, but keep the encoder state */
+	if ((len = lame_encode_flush_nogap(w->gfp, w->mp3buf, sizeof(w->mp3buf))) < 0)
+		error("LAME: Couldn't flush encoder: %d", len);
+	else
+		output_write(w->out, w->mp3buf, len);
+
+	output_close(w->out);
+	w->out = NULL;
+	w->nogap = true;
 }
 
 ssize_t writer_mp3lame_write(struct writer_mp3lame *w, int16_t *buffer, size_t frames) {
-	int len = lame_encode(w->gfp, buffer, frames, w->mp3buf, sizeof(w->mp3buf));
-	return fwrite(w->mp3buf, 1, len, w->fp);
+
+	const int channels = lame_get_num_channels(w->gfp);
+	ssize_t total = 0;
+	ssize_t ret;
+	int len;
+
+	while (frames > 0) {
+
+		const size_t chunk = frames < WRITER_MP3LAME_CHUNK_FRAMES ?
+			frames : WRITER_MP3LAME_CHUNK_FRAMES;
+
+		/* the output buffer is sized for the worst case, so the failure here
+		 * means that something is seriously wrong with the encoder */
+		if ((len = lame_encode(w->gfp, buffer, chunk, w->mp3buf, sizeof(w->mp3buf))) < 0) {
+			error("LAME: Couldn't encode frames: %d", len);
+			return -1;
+		}
+
+		if ((ret = output_write(w->out, w->mp3buf, len)) == -1)
+			return -1;
+
+		buffer += chunk * channels;
+		frames -= chunk;
+		total += ret;
+
+	}
+
+	return total;
 }
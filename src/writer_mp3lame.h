@@ -7,21 +7,35 @@
 #ifndef SVAR_WRITER_MP3LAME_H_
 #define SVAR_WRITER_MP3LAME_H_
 
+#include <stdbool.h>
 #include <stdint.h>
-#include <stdio.h>
+#include <sys/types.h>
 #include <lame/lame.h>
 
+#include "output.h"
+
+/* Number of frames passed to the encoder at once. Input and output of a
+ * single chunk stay in the CPU cache, and the encoding latency does not
+ * depend on the size of the processed block. */
+#define WRITER_MP3LAME_CHUNK_FRAMES 4096
+
+/* Worst-case size of the encoded data for the given number of samples per
+ * channel, as documented by the LAME API. It also covers the flush. */
+#define WRITER_MP3LAME_BUFFER_SIZE(samples) (5 * (samples) / 4 + 7200)
+
 struct writer_mp3lame {
 	lame_global_flags *gfp;
-	unsigned char mp3buf[1024 * 64];
-	FILE *fp;
+	unsigned char mp3buf[WRITER_MP3LAME_BUFFER_SIZE(WRITER_MP3LAME_CHUNK_FRAMES)];
+	struct output *out;
+	/* encoder has been flushed in the no-gap mode */
+	bool nogap;
 };
 
 struct writer_mp3lame *writer_mp3lame_init(int channels, int sampling,
 		int bitrate_min, int bitrate_max, const char *comment);
 void writer_mp3lame_free(struct writer_mp3lame *w);
 
-int writer_mp3lame_open(struct writer_mp3lame *w, const char *pathname);
+int writer_mp3lame_open(struct writer_mp3lame *w, struct output *out);
 void writer_mp3lame_close(struct writer_mp3lame *w);
 
 ssize_t writer_mp3lame_write(struct writer_mp3lame *w, int16_t *buffer, size_t frames);
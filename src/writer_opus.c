@@ -0,0 +1,265 @@
+/*
+ * SVAR - writer_opus.c
+ * SPDX-FileCopyrightText: 2025 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "writer_opus.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "debug.h"
+
+static void put_le16(unsigned char *p, uint16_t v) {
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put_le32(unsigned char *p, uint32_t v) {
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+/* Create identification header packet (RFC 7845, section 5.1). */
+static int opus_head_packet(ogg_packet *p, int channels, int sampling, int pre_skip) {
+
+	unsigned char *data;
+	if ((data = malloc(19)) == NULL)
+		return -1;
+
+	memcpy(data, "OpusHead", 8);
+	data[8] = 1;
+	data[9] = channels;
+	put_le16(&data[10], pre_skip);
+	put_le32(&data[12], sampling);
+	/* output gain */
+	put_le16(&data[16], 0);
+	/* mono or stereo without the channel mapping table */
+	data[18] = 0;
+
+	memset(p, 0, sizeof(*p));
+	p->packet = data;
+	p->bytes = 19;
+	p->b_o_s = 1;
+	p->packetno = 0;
+	return 0;
+}
+
+/* Create comment header packet (RFC 7845, section 5.2). */
+static int opus_tags_packet(ogg_packet *p, const char *comment) {
+
+	const char *vendor = opus_get_version_string();
+	const size_t vendor_len = strlen(vendor);
+	const size_t comment_len = strlen("ENCODER=") + strlen(comment);
+	const size_t size = 8 + 4 + vendor_len + 4 + 4 + comment_len;
+	unsigned char *data;
+
+	if ((data = malloc(size)) == NULL)
+		return -1;
+
+	unsigned char *ptr = data;
+	memcpy(ptr, "OpusTags", 8);
+	put_le32(ptr += 8, vendor_len);
+	memcpy(ptr += 4, vendor, vendor_len);
+	put_le32(ptr += vendor_len, 1);
+	put_le32(ptr += 4, comment_len);
+	memcpy(ptr += 4, "ENCODER=", 8);
+	memcpy(ptr + 8, comment, comment_len - 8);
+
+	memset(p, 0, sizeof(*p));
+	p->packet = data;
+	p->bytes = size;
+	p->packetno = 1;
+	return 0;
+}
+
+static size_t write_ogg_pages(struct writer_opus *w, bool flush) {
+
+	ogg_page o_page;
+	size_t len = 0;
+
+	while (flush ? ogg_stream_flush(&w->ogg_s, &o_page) :
+			ogg_stream_pageout(&w->ogg_s, &o_page)) {
+		len += output_write(w->out, o_page.header, o_page.header_len);
+		len += output_write(w->out, o_page.body, o_page.body_len);
+	}
+
+	return len;
+}
+
+/* Encode buffered frame and put the packet into the OGG stream. */
+static int encode_frame(struct writer_opus *w, bool eos) {
+
+	const opus_int32 len = opus_encode(w->enc, w->pcm, w->pcm_size,
+			w->packet, sizeof(w->packet));
+	if (len < 0) {
+		error("Opus: Couldn't encode frame: %s", opus_strerror(len));
+		return -1;
+	}
+
+	w->encoded += w->pcm_size;
+	w->pcm_frames = 0;
+
+	ogg_packet o_pack = {
+		.packet = w->packet,
+		.bytes = len,
+		.e_o_s = eos,
+		/* Granule position is the number of decoded samples (including the
+		 * pre-skip) at 48 kHz. The last packet is trimmed to the number of
+		 * input samples, so the padding is not played back. */
+		.granulepos = (eos ? w->samples + w->lookahead : w->encoded) * w->granule_scale,
+		.packetno = w->packetno++,
+	};
+
+	ogg_stream_packetin(&w->ogg_s, &o_pack);
+	return 0;
+}
+
+struct writer_opus *writer_opus_init(int channels, int sampling, int application,
+		int bitrate, int complexity, const char *comment) {
+
+	struct writer_opus *w;
+	opus_int32 lookahead;
+	int err;
+
+	if ((w = calloc(1, sizeof(*w))) == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	/* channel mapping family 0 supports mono and stereo only */
+	if (channels > 2) {
+		error("Opus: Unsupported number of channels: %d", channels);
+		errno = EINVAL;
+		goto fail;
+	}
+
+	if ((w->enc = opus_encoder_create(sampling, channels, application, &err)) == NULL) {
+		error("Opus: Couldn't create encoder: %s", opus_strerror(err));
+		errno = EINVAL;
+		goto fail;
+	}
+
+	if ((err = opus_encoder_ctl(w->enc, OPUS_SET_BITRATE(bitrate))) != OPUS_OK ||
+			(err = opus_encoder_ctl(w->enc, OPUS_SET_COMPLEXITY(complexity))) != OPUS_OK ||
+			(err = opus_encoder_ctl(w->enc, OPUS_GET_LOOKAHEAD(&lookahead))) != OPUS_OK) {
+		error("Opus: Couldn't setup encoder: %s", opus_strerror(err));
+		errno = EINVAL;
+		goto fail;
+	}
+
+	w->channels = channels;
+	w->lookahead = lookahead;
+	/* encoder accepts only rates which are divisors of 48 kHz */
+	w->granule_scale = 48000 / sampling;
+	/* 20 ms frames give the best quality to size ratio for speech */
+	w->pcm_size = sampling / 50;
+
+	if ((w->pcm = malloc(sizeof(*w->pcm) * channels * w->pcm_size)) == NULL ||
+			opus_head_packet(&w->ogg_p_head, channels, sampling,
+				lookahead * w->granule_scale) == -1 ||
+			opus_tags_packet(&w->ogg_p_tags, comment) == -1) {
+		errno = ENOMEM;
+		goto fail;
+	}
+
+	ogg_stream_init(&w->ogg_s, time(NULL));
+	w->initialized = true;
+
+	return w;
+
+fail:
+	writer_opus_free(w);
+	return NULL;
+}
+
+void writer_opus_free(struct writer_opus *w) {
+	writer_opus_close(w);
+	if (w->initialized)
+		ogg_stream_clear(&w->ogg_s);
+	if (w->enc != NULL)
+		opus_encoder_destroy(w->enc);
+	free(w->ogg_p_head.packet);
+	free(w->ogg_p_tags.packet);
+	free(w->pcm);
+	free(w);
+}
+
+/* Start new OGG stream. The writer takes ownership of the output. */
+int writer_opus_open(struct writer_opus *w, struct output *out) {
+
+	writer_opus_close(w);
+	w->out = out;
+
+	/* every stream has to be decodable on its own */
+	opus_encoder_ctl(w->enc, OPUS_RESET_STATE);
+	w->pcm_frames = 0;
+	w->samples = 0;
+	w->encoded = 0;
+	w->packetno = 2;
+
+	/* header packets have to be placed on separate pages */
+	ogg_stream_reset_serialno(&w->ogg_s, time(NULL));
+	ogg_stream_packetin(&w->ogg_s, &w->ogg_p_head);
+	write_ogg_pages(w, true);
+	ogg_stream_packetin(&w->ogg_s, &w->ogg_p_tags);
+	write_ogg_pages(w, true);
+
+	return 0;
+}
+
+void writer_opus_close(struct writer_opus *w) {
+
+	bool eos;
+
+	if (w->out == NULL)
+		return;
+
+	/* Pad the last frame with silence and encode until all input samples
+	 * delayed by the encoder lookahead are out. */
+	do {
+		memset(&w->pcm[w->pcm_frames * w->channels], 0,
+				sizeof(*w->pcm) * w->channels * (w->pcm_size - w->pcm_frames));
+		eos = w->encoded + w->pcm_size >= w->samples + w->lookahead;
+		if (encode_frame(w, eos) == -1)
+			break;
+	} while (!eos);
+
+	write_ogg_pages(w, true);
+	output_close(w->out);
+	w->out = NULL;
+
+}
+
+ssize_t writer_opus_write(struct writer_opus *w, int16_t *buffer, size_t frames) {
+
+	ssize_t len = 0;
+
+	while (frames > 0) {
+
+		size_t n = w->pcm_size - w->pcm_frames;
+		if (n > frames)
+			n = frames;
+
+		memcpy(&w->pcm[w->pcm_frames * w->channels], buffer,
+				sizeof(*buffer) * w->channels * n);
+		buffer += w->channels * n;
+		w->pcm_frames += n;
+		w->samples += n;
+		frames -= n;
+
+		if (w->pcm_frames == w->pcm_size) {
+			if (encode_frame(w, false) == -1)
+				return -1;
+			len += write_ogg_pages(w, false);
+		}
+
+	}
+
+	return len;
+}
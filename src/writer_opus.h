@@ -0,0 +1,54 @@
+/*
+ * SVAR - writer_opus.h
+ * SPDX-FileCopyrightText: 2025 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef SVAR_WRITER_OPUS_H_
+#define SVAR_WRITER_OPUS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <ogg/ogg.h>
+#include <opus.h>
+
+#include "output.h"
+
+/* Maximal size of a single Opus packet recommended by the API. */
+#define WRITER_OPUS_PACKET_SIZE 4000
+
+struct writer_opus {
+	OpusEncoder *enc;
+	ogg_stream_state ogg_s;
+	bool initialized;
+	int channels;
+	/* encoder lookahead (in input frames) */
+	int lookahead;
+	/* 48 kHz granule units per input frame */
+	int granule_scale;
+	/* cached header packets */
+	ogg_packet ogg_p_head;
+	ogg_packet ogg_p_tags;
+	/* input buffer for a single encoder frame */
+	int16_t *pcm;
+	size_t pcm_size;
+	size_t pcm_frames;
+	/* input and encoded frames in the current stream */
+	uint64_t samples;
+	uint64_t encoded;
+	ogg_int64_t packetno;
+	unsigned char packet[WRITER_OPUS_PACKET_SIZE];
+	struct output *out;
+};
+
+struct writer_opus *writer_opus_init(int channels, int sampling, int application,
+		int bitrate, int complexity, const char *comment);
+void writer_opus_free(struct writer_opus *w);
+
+int writer_opus_open(struct writer_opus *w, struct output *out);
+void writer_opus_close(struct writer_opus *w);
+
+ssize_t writer_opus_write(struct writer_opus *w, int16_t *buffer, size_t frames);
+
+#endif
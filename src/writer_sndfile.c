@@ -11,6 +11,38 @@
 
 #include "debug.h"
 
+static sf_count_t vio_get_filelen(void *user_data) {
+	return output_length(user_data);
+}
+
+static sf_count_t vio_seek(sf_count_t offset, int whence, void *user_data) {
+	return output_seek(user_data, offset, whence);
+}
+
+static sf_count_t vio_read(void *ptr, sf_count_t count, void *user_data) {
+	/* output is write-only */
+	(void)ptr;
+	(void)count;
+	(void)user_data;
+	return 0;
+}
+
+static sf_count_t vio_write(const void *ptr, sf_count_t count, void *user_data) {
+	return output_write(user_data, ptr, count);
+}
+
+static sf_count_t vio_tell(void *user_data) {
+	return output_tell(user_data);
+}
+
+static SF_VIRTUAL_IO vio = {
+	.get_filelen = vio_get_filelen,
+	.seek = vio_seek,
+	.read = vio_read,
+	.write = vio_write,
+	.tell = vio_tell,
+};
+
 struct writer_sndfile *writer_sndfile_init(int channels, int sampling, int format) {
 
 	struct writer_sndfile *w;
@@ -31,11 +63,13 @@ void writer_sndfile_free(struct writer_sndfile *w) {
 	free(w);
 }
 
-int writer_sndfile_open(struct writer_sndfile *w, const char *pathname) {
+/* Start new sound file. The writer takes ownership of the output. */
+int writer_sndfile_open(struct writer_sndfile *w, struct output *out) {
 
 	writer_sndfile_close(w);
+	w->out = out;
 
-	if ((w->sf = sf_open(pathname, SFM_WRITE, &w->sfinfo)) == NULL) {
+	if ((w->sf = sf_open_virtual(&vio, SFM_WRITE, &w->sfinfo, w->out)) == NULL) {
 		error("Couldn't create output file: %s", sf_strerror(NULL));
 		return -1;
 	}
@@ -48,6 +82,10 @@ void writer_sndfile_close(struct writer_sndfile *w) {
 		sf_close(w->sf);
 		w->sf = NULL;
 	}
+	if (w->out != NULL) {
+		output_close(w->out);
+		w->out = NULL;
+	}
 }
 
 ssize_t writer_sndfile_write(struct writer_sndfile *w, int16_t *buffer, size_t frames) {
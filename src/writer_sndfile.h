@@ -8,17 +8,21 @@
 #define SVAR_WRITER_SNDFILE_H_
 
 #include <stdint.h>
+#include <sys/types.h>
 #include <sndfile.h>
 
+#include "output.h"
+
 struct writer_sndfile {
 	SNDFILE *sf;
 	SF_INFO sfinfo;
+	struct output *out;
 };
 
 struct writer_sndfile *writer_sndfile_init(int channels, int sampling, int format);
 void writer_sndfile_free(struct writer_sndfile *w);
 
-int writer_sndfile_open(struct writer_sndfile *w, const char *pathname);
+int writer_sndfile_open(struct writer_sndfile *w, struct output *out);
 void writer_sndfile_close(struct writer_sndfile *w);
 
 ssize_t writer_sndfile_write(struct writer_sndfile *w, int16_t *buffer, size_t frames);
@@ -8,8 +8,20 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
+#include "level.h"
+
+/* Make a deep copy of the OGG packet. */
+static int ogg_packet_copy(ogg_packet *dst, const ogg_packet *src) {
+	*dst = *src;
+	if ((dst->packet = malloc(src->bytes)) == NULL)
+		return -1;
+	memcpy(dst->packet, src->packet, src->bytes);
+	return 0;
+}
+
 static size_t do_analysis_and_write_ogg(struct writer_vorbis *w) {
 
 	ogg_packet o_pack;
@@ -26,8 +38,8 @@ static size_t do_analysis_and_write_ogg(struct writer_vorbis *w) {
 
 			/* form OGG pages and write it to output file */
 			while (ogg_stream_pageout(&w->ogg_s, &o_page)) {
-				len += fwrite(o_page.header, 1, o_page.header_len, w->fp);
-				len += fwrite(o_page.body, 1, o_page.body_len, w->fp);
+				len += output_write(w->out, o_page.header, o_page.header_len);
+				len += output_write(w->out, o_page.body, o_page.body_len);
 			}
 		}
 	}
@@ -36,7 +48,8 @@ static size_t do_analysis_and_write_ogg(struct writer_vorbis *w) {
 }
 
 struct writer_vorbis *writer_vorbis_init(int channels, int sampling,
-		int bitrate_min, int bitrate_nom, int bitrate_max, const char *comment) {
+		int bitrate_min, int bitrate_nom, int bitrate_max, bool dc_filter,
+		const char *comment) {
 
 	struct writer_vorbis *w;
 	if ((w = calloc(1, sizeof(*w))) == NULL) {
@@ -63,6 +76,29 @@ struct writer_vorbis *writer_vorbis_init(int channels, int sampling,
 	vorbis_comment_init(&w->vbs_c);
 	vorbis_comment_add(&w->vbs_c, comment);
 
+	if (dc_filter &&
+			(w->dc = calloc(channels, sizeof(*w->dc))) == NULL) {
+		errno = ENOMEM;
+		goto fail;
+	}
+
+	/* initialize vorbis analyzer */
+	vorbis_analysis_init(&w->vbs_d, &w->vbs_i);
+	vorbis_block_init(&w->vbs_d, &w->vbs_b);
+	ogg_stream_init(&w->ogg_s, time(NULL));
+	w->initialized = true;
+
+	/* Header packets depend only on the encoder setup and the comment, so
+	 * they are generated once and reused for every stream. */
+	ogg_packet p_main, p_comm, p_code;
+	vorbis_analysis_headerout(&w->vbs_d, &w->vbs_c, &p_main, &p_comm, &p_code);
+	if (ogg_packet_copy(&w->ogg_p_main, &p_main) == -1 ||
+			ogg_packet_copy(&w->ogg_p_comm, &p_comm) == -1 ||
+			ogg_packet_copy(&w->ogg_p_code, &p_code) == -1) {
+		errno = ENOMEM;
+		goto fail;
+	}
+
 	return w;
 
 fail:
@@ -72,25 +108,32 @@ fail:
 
 void writer_vorbis_free(struct writer_vorbis *w) {
 	writer_vorbis_close(w);
+	if (w->initialized) {
+		ogg_stream_clear(&w->ogg_s);
+		vorbis_block_clear(&w->vbs_b);
+		vorbis_dsp_clear(&w->vbs_d);
+	}
+	free(w->ogg_p_main.packet);
+	free(w->ogg_p_comm.packet);
+	free(w->ogg_p_code.packet);
+	free(w->dc);
 	vorbis_comment_clear(&w->vbs_c);
 	vorbis_info_clear(&w->vbs_i);
 	free(w);
 }
 
-int writer_vorbis_open(struct writer_vorbis *w, const char *pathname) {
+/* Start new OGG stream. The writer takes ownership of the output. */
+int writer_vorbis_open(struct writer_vorbis *w, struct output *out) {
 
 	writer_vorbis_close(w);
+	w->out = out;
 
-	if ((w->fp = fopen(pathname, "w")) == NULL)
-		return -1;
+	/* every stream starts with a fresh DC offset estimation */
+	if (w->dc != NULL)
+		memset(w->dc, 0, sizeof(*w->dc) * w->vbs_i.channels);
 
-	/* initialize vorbis analyzer */
-	vorbis_analysis_init(&w->vbs_d, &w->vbs_i);
-	vorbis_block_init(&w->vbs_d, &w->vbs_b);
-	ogg_stream_init(&w->ogg_s, time(NULL));
-
-	/* write header packets to the OGG stream */
-	vorbis_analysis_headerout(&w->vbs_d, &w->vbs_c, &w->ogg_p_main, &w->ogg_p_comm, &w->ogg_p_code);
+	/* write cached header packets to the new OGG stream */
+	ogg_stream_reset_serialno(&w->ogg_s, time(NULL));
 	ogg_stream_packetin(&w->ogg_s, &w->ogg_p_main);
 	ogg_stream_packetin(&w->ogg_s, &w->ogg_p_comm);
 	ogg_stream_packetin(&w->ogg_s, &w->ogg_p_code);
@@ -103,30 +146,51 @@ void writer_vorbis_close(struct writer_vorbis *w) {
 	ogg_page o_page;
 	size_t len = 0;
 
-	if (w->fp == NULL)
+	if (w->out == NULL)
 		return;
 	vorbis_analysis_wrote(&w->vbs_d, 0);
 	do_analysis_and_write_ogg(w);
 	/* flush any un-written partial ogg page */
 	while (ogg_stream_flush(&w->ogg_s, &o_page)) {
-		len += fwrite(o_page.header, 1, o_page.header_len, w->fp);
-		len += fwrite(o_page.body, 1, o_page.body_len, w->fp);
+		len += output_write(w->out, o_page.header, o_page.header_len);
+		len += output_write(w->out, o_page.body, o_page.body_len);
 	}
-	ogg_stream_clear(&w->ogg_s);
+	output_close(w->out);
+	w->out = NULL;
+
+	/* The analyzer can not be restarted after the end of stream, so it has
+	 * to be re-initialized. Do it right now, so the next stream can be
+	 * opened without any delay. */
 	vorbis_block_clear(&w->vbs_b);
 	vorbis_dsp_clear(&w->vbs_d);
-	fclose(w->fp);
-	w->fp = NULL;
+	vorbis_analysis_init(&w->vbs_d, &w->vbs_i);
+	vorbis_block_init(&w->vbs_d, &w->vbs_b);
 }
 
 ssize_t writer_vorbis_write(struct writer_vorbis *w, int16_t *buffer, size_t frames) {
 
-	/* convert interleaved 16-bit buffer into vorbis buffer */
-	float **vbs_buffer = vorbis_analysis_buffer(&w->vbs_d, frames);
-	for (size_t fi = 0; fi < frames; fi++)
-		for (int ci = 0; ci < w->vbs_i.channels; ci++)
-			vbs_buffer[ci][fi] = (float)(buffer[fi * w->vbs_i.channels + ci]) / 0x7ffe;
+	const int channels = w->vbs_i.channels;
+	ssize_t total = 0;
+
+	/* Encode in chunks, so the analysis buffer does not grow with the size
+	 * of the processed block and the converted data are still in the CPU
+	 * cache when the analysis runs. */
+	while (frames > 0) {
+
+		const size_t chunk = frames < WRITER_VORBIS_CHUNK_FRAMES ?
+			frames : WRITER_VORBIS_CHUNK_FRAMES;
+
+		/* convert interleaved 16-bit buffer into vorbis buffer */
+		float **vbs_buffer = vorbis_analysis_buffer(&w->vbs_d, chunk);
+		level_planes_S16_LE(buffer, chunk, channels, vbs_buffer, w->dc);
+
+		vorbis_analysis_wrote(&w->vbs_d, chunk);
+		total += do_analysis_and_write_ogg(w);
+
+		buffer += chunk * channels;
+		frames -= chunk;
+
+	}
 
-	vorbis_analysis_wrote(&w->vbs_d, frames);
-	return do_analysis_and_write_ogg(w);
+	return total;
 }
@@ -7,12 +7,19 @@
 #ifndef SVAR_WRITER_VORBIS_H_
 #define SVAR_WRITER_VORBIS_H_
 
+#include <stdbool.h>
 #include <stdint.h>
-#include <stdio.h>
+#include <sys/types.h>
 #include <vorbis/vorbisenc.h>
 
+#include "output.h"
+
+/* Number of frames passed to the encoder at once. */
+#define WRITER_VORBIS_CHUNK_FRAMES 4096
+
 struct writer_vorbis {
 	ogg_stream_state ogg_s;
+	/* cached header packets */
 	ogg_packet ogg_p_main;
 	ogg_packet ogg_p_comm;
 	ogg_packet ogg_p_code;
@@ -20,14 +27,18 @@ struct writer_vorbis {
 	vorbis_dsp_state vbs_d;
 	vorbis_block vbs_b;
 	vorbis_comment vbs_c;
-	FILE *fp;
+	bool initialized;
+	/* per-channel DC offset (NULL if not removed) */
+	float *dc;
+	struct output *out;
 };
 
 struct writer_vorbis *writer_vorbis_init(int channels, int sampling,
-		int bitrate_min, int bitrate_nom, int bitrate_max, const char *comment);
+		int bitrate_min, int bitrate_nom, int bitrate_max, bool dc_filter,
+		const char *comment);
 void writer_vorbis_free(struct writer_vorbis *w);
 
-int writer_vorbis_open(struct writer_vorbis *w, const char *pathname);
+int writer_vorbis_open(struct writer_vorbis *w, struct output *out);
 void writer_vorbis_close(struct writer_vorbis *w);
 
 ssize_t writer_vorbis_write(struct writer_vorbis *w, int16_t *buffer, size_t frames);
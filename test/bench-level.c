@@ -0,0 +1,73 @@
+/*
+ * SVAR - bench-level.c
+ * SPDX-FileCopyrightText: 2025 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../src/level.h"
+
+/* Number of frames converted at once, the same as in the vorbis writer. */
+#define BENCH_FRAMES 4096
+#define BENCH_CHANNELS_MAX 6
+/* Number of samples converted in every benchmark run. */
+#define BENCH_SAMPLES (256 * 1024 * 1024)
+
+static const unsigned int bench_channels[] = { 1, 2, BENCH_CHANNELS_MAX };
+
+static int16_t buffer[BENCH_FRAMES * BENCH_CHANNELS_MAX];
+static float planes[BENCH_CHANNELS_MAX][BENCH_FRAMES];
+
+/* Per-sample conversion loop used before the SIMD kernels. */
+static void convert_per_sample(const int16_t *buffer, size_t frames,
+		unsigned int channels, float *const *planes) {
+	for (size_t fi = 0; fi < frames; fi++)
+		for (unsigned int ci = 0; ci < channels; ci++)
+			planes[ci][fi] = (float)(buffer[fi * channels + ci]) / 0x7ffe;
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(void) {
+
+	float *const dst[BENCH_CHANNELS_MAX] = {
+		planes[0], planes[1], planes[2], planes[3], planes[4], planes[5] };
+	float dc[BENCH_CHANNELS_MAX] = { 0 };
+	size_t i, n;
+
+	level_init();
+	printf("Level kernel: %s\n", level_kernel_name());
+
+	srand(1);
+	for (i = 0; i < sizeof(buffer) / sizeof(*buffer); i++)
+		buffer[i] = rand();
+
+	for (i = 0; i < sizeof(bench_channels) / sizeof(*bench_channels); i++) {
+
+		const unsigned int channels = bench_channels[i];
+		const size_t loops = BENCH_SAMPLES / (BENCH_FRAMES * channels);
+		double t0, t1, t2;
+
+		t0 = now();
+		for (n = 0; n < loops; n++)
+			convert_per_sample(buffer, BENCH_FRAMES, channels, dst);
+		t1 = now();
+		for (n = 0; n < loops; n++)
+			level_planes_S16_LE(buffer, BENCH_FRAMES, channels, dst, dc);
+		t2 = now();
+
+		printf("channels=%u: per-sample: %.3f s, planes: %.3f s, speedup: %.2fx\n",
+				channels, t1 - t0, t2 - t1, (t1 - t0) / (t2 - t1));
+
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,204 @@
+/*
+ * SVAR - test-level.c
+ * SPDX-FileCopyrightText: 2025 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+/* SIMD kernels are not exported, so include the implementation directly. */
+#include "../src/level.c"
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Number of frames in the test buffer. The largest size is big enough to
+ * overflow 32-bit sum of squares accumulators. */
+#define TEST_FRAMES_MAX 70001
+#define TEST_CHANNELS_MAX 8
+
+struct reduce_kernel {
+	const char *name;
+	level_reduce_t fn;
+};
+
+struct convert_kernel {
+	const char *name;
+	level_convert_t fn;
+};
+
+static const size_t test_frames[] = { 0, 1, 3, 7, 8, 15, 17, 31, 33, 255, 1023, 4099, TEST_FRAMES_MAX };
+static const unsigned int test_channels[] = { 1, 2, 3, 4, TEST_CHANNELS_MAX };
+
+static int16_t buffer[TEST_FRAMES_MAX * TEST_CHANNELS_MAX + 1];
+static float planes_ref[TEST_CHANNELS_MAX][TEST_FRAMES_MAX];
+static float planes[TEST_CHANNELS_MAX][TEST_FRAMES_MAX];
+
+/* Get reduction kernels supported by the current CPU. */
+static unsigned int get_reduce_kernels(struct reduce_kernel *kernels) {
+	unsigned int n = 0;
+#if LEVEL_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		kernels[n++] = (struct reduce_kernel){ "SSE2", level_reduce_S16_LE_sse2 };
+	if (__builtin_cpu_supports("avx2"))
+		kernels[n++] = (struct reduce_kernel){ "AVX2", level_reduce_S16_LE_avx2 };
+#elif LEVEL_NEON
+	kernels[n++] = (struct reduce_kernel){ "NEON", level_reduce_S16_LE_neon };
+#endif
+	(void)kernels;
+	return n;
+}
+
+/* Get conversion kernels supported by the current CPU. */
+static unsigned int get_convert_kernels(struct convert_kernel *kernels) {
+	unsigned int n = 0;
+#if LEVEL_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		kernels[n++] = (struct convert_kernel){ "SSE2", level_convert_S16_LE_sse2 };
+#elif LEVEL_NEON
+	kernels[n++] = (struct convert_kernel){ "NEON", level_convert_S16_LE_neon };
+#endif
+	(void)kernels;
+	return n;
+}
+
+static void fill_random(int16_t *data, size_t samples) {
+	for (size_t i = 0; i < samples; i++)
+		data[i] = rand();
+}
+
+static void fill_value(int16_t *data, size_t samples, int16_t value) {
+	for (size_t i = 0; i < samples; i++)
+		data[i] = value;
+}
+
+/* Compare given kernel with the reference implementation. The buffer is
+ * also checked at an odd offset, so the unaligned access is exercised. */
+static bool test_reduce(const struct reduce_kernel *k, const char *pattern) {
+
+	bool ok = true;
+
+	for (size_t i = 0; i < sizeof(test_channels) / sizeof(*test_channels); i++)
+		for (size_t j = 0; j < sizeof(test_frames) / sizeof(*test_frames); j++)
+			for (size_t offset = 0; offset < 2; offset++) {
+
+				const unsigned int channels = test_channels[i];
+				const size_t frames = test_frames[j];
+				const int16_t *data = &buffer[offset];
+				int16_t peak_ref[TEST_CHANNELS_MAX] = { 0 };
+				int16_t peak[TEST_CHANNELS_MAX] = { 0 };
+				uint64_t sum2_ref[TEST_CHANNELS_MAX] = { 0 };
+				uint64_t sum2[TEST_CHANNELS_MAX] = { 0 };
+
+				level_reduce_S16_LE_scalar(data, frames, channels, peak_ref, sum2_ref);
+				k->fn(data, frames, channels, peak, sum2);
+
+				for (unsigned int c = 0; c < channels; c++)
+					if (peak[c] != peak_ref[c] || sum2[c] != sum2_ref[c]) {
+						fprintf(stderr, "%s reduce [%s]: channels=%u frames=%zu offset=%zu: "
+								"channel %u: peak %d != %d or sum2 %" PRIu64 " != %" PRIu64 "\n",
+								k->name, pattern, channels, frames, offset, c,
+								peak[c], peak_ref[c], sum2[c], sum2_ref[c]);
+						ok = false;
+						break;
+					}
+
+			}
+
+	return ok;
+}
+
+/* Compare given kernel with the reference implementation. Converted samples
+ * may differ in the last bit, because the reference might be compiled with
+ * fused multiply-add instructions, but sums have to be exact. */
+static bool test_convert(const struct convert_kernel *k, const char *pattern) {
+
+	const float scale = 1.0f / 0x7ffe;
+	const float bias[TEST_CHANNELS_MAX] = { 0, -0.5f, 0.25f, 1e-3f, -1e-3f, 0.1f, -0.1f, 1 };
+	float *const dst_ref[TEST_CHANNELS_MAX] = {
+		planes_ref[0], planes_ref[1], planes_ref[2], planes_ref[3],
+		planes_ref[4], planes_ref[5], planes_ref[6], planes_ref[7] };
+	float *const dst[TEST_CHANNELS_MAX] = {
+		planes[0], planes[1], planes[2], planes[3],
+		planes[4], planes[5], planes[6], planes[7] };
+	bool ok = true;
+
+	for (size_t i = 0; i < sizeof(test_channels) / sizeof(*test_channels); i++)
+		for (size_t j = 0; j < sizeof(test_frames) / sizeof(*test_frames); j++)
+			for (size_t offset = 0; offset < 2; offset++) {
+
+				const unsigned int channels = test_channels[i];
+				/* 32-bit sums of a single block must not overflow */
+				const size_t frames = test_frames[j] < 4099 ? test_frames[j] : 4099;
+				const int16_t *data = &buffer[offset];
+				int32_t sum_ref[TEST_CHANNELS_MAX] = { 0 };
+				int32_t sum[TEST_CHANNELS_MAX] = { 0 };
+
+				level_convert_S16_LE_scalar(data, frames, channels, dst_ref, scale, bias, sum_ref);
+				k->fn(data, frames, channels, dst, scale, bias, sum);
+
+				for (unsigned int c = 0; c < channels; c++) {
+
+					if (sum[c] != sum_ref[c]) {
+						fprintf(stderr, "%s convert [%s]: channels=%u frames=%zu offset=%zu: "
+								"channel %u: sum %" PRId32 " != %" PRId32 "\n",
+								k->name, pattern, channels, frames, offset, c, sum[c], sum_ref[c]);
+						ok = false;
+						break;
+					}
+
+					for (size_t n = 0; n < frames; n++)
+						if (fabsf(planes[c][n] - planes_ref[c][n]) > 1e-6f) {
+							fprintf(stderr, "%s convert [%s]: channels=%u frames=%zu offset=%zu: "
+									"channel %u: sample %zu: %f != %f\n",
+									k->name, pattern, channels, frames, offset, c, n,
+									planes[c][n], planes_ref[c][n]);
+							ok = false;
+							break;
+						}
+
+				}
+
+			}
+
+	return ok;
+}
+
+int main(void) {
+
+	const size_t samples = sizeof(buffer) / sizeof(*buffer);
+	struct reduce_kernel reduce_kernels[4];
+	struct convert_kernel convert_kernels[4];
+	unsigned int reduce_kernels_count;
+	unsigned int convert_kernels_count;
+	bool ok = true;
+
+	srand(1);
+	reduce_kernels_count = get_reduce_kernels(reduce_kernels);
+	convert_kernels_count = get_convert_kernels(convert_kernels);
+
+	for (unsigned int i = 0; i < reduce_kernels_count; i++) {
+		printf("Testing %s reduction kernel\n", reduce_kernels[i].name);
+		fill_random(buffer, samples);
+		ok &= test_reduce(&reduce_kernels[i], "random");
+		fill_value(buffer, samples, INT16_MIN);
+		ok &= test_reduce(&reduce_kernels[i], "INT16_MIN");
+		fill_value(buffer, samples, INT16_MAX);
+		ok &= test_reduce(&reduce_kernels[i], "INT16_MAX");
+	}
+
+	for (unsigned int i = 0; i < convert_kernels_count; i++) {
+		printf("Testing %s conversion kernel\n", convert_kernels[i].name);
+		fill_random(buffer, samples);
+		ok &= test_convert(&convert_kernels[i], "random");
+		fill_value(buffer, samples, INT16_MIN);
+		ok &= test_convert(&convert_kernels[i], "INT16_MIN");
+		fill_value(buffer, samples, INT16_MAX);
+		ok &= test_convert(&convert_kernels[i], "INT16_MAX");
+	}
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}